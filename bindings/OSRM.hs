@@ -0,0 +1,330 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+module OSRM
+    ( -- * Handles
+      Config(..)
+    , OSRM(..)
+    , RouteParams(..)
+    , TableParams(..)
+    , TableResponse(..)
+    , Params(..)
+      -- * Results
+    , OSRMError(..)
+    , Coordinate(..)
+    , RouteSummary(..)
+    , Table(..)
+      -- * ABI Stability
+    , getVersion
+    , isABICompatible
+      -- * Engine
+    , newConfig
+    , newOSRM
+    , closeOSRM
+      -- * Coordinates
+    , addCoordinate
+    , addCoordinates
+      -- * Route service
+    , newRouteParams
+    , route
+      -- * Table service
+    , newTableParams
+    , enableDistances
+    , table
+    , durations
+    , distances
+    ) where
+
+import Foreign.C
+import Foreign.Ptr
+import Foreign.ForeignPtr
+import Foreign.Storable (peek, poke)
+import Foreign.Marshal.Alloc (alloca)
+
+import Data.IORef (newIORef, readIORef, writeIORef)
+import Control.Exception (Exception, bracket, throwIO)
+import Control.Monad (when)
+
+import qualified Data.Vector.Storable as VS
+import qualified Data.Vector.Storable.Mutable as VSM
+
+
+-- Opaque Types
+--
+-- Handles are owned by ForeignPtrs whose finalizers call the matching osrmc_*_destruct, so they
+-- can be shared freely and are released by the garbage collector. The engine holds the whole dataset;
+-- use closeOSRM to release it deterministically instead of waiting for a major collection.
+
+newtype Config = Config { getConfig :: ForeignPtr Config }
+newtype OSRM = OSRM { getOSRM :: ForeignPtr OSRM }
+newtype RouteParams = RouteParams { getRouteParams :: ForeignPtr RouteParams }
+newtype TableParams = TableParams { getTableParams :: ForeignPtr TableParams }
+newtype TableResponse = TableResponse { getTableResponse :: ForeignPtr TableResponse }
+
+data ParamsHandle
+data AnnotationsHandle
+data VisitorHandle
+data ErrorHandle
+
+-- Route and table parameters share the coordinate setters (osrmc_params_t);
+-- deadline and priority have one setter per service
+class Params p where
+    withParams :: p -> (Ptr ParamsHandle -> IO a) -> IO a
+    -- | Deadline in milliseconds from the moment the query is issued, 0 for none.
+    setDeadline :: p -> Int -> IO ()
+    -- | Priority among queued expensive queries, higher first.
+    setPriority :: p -> Int -> IO ()
+
+instance Params RouteParams where
+    withParams (RouteParams p) body = withForeignPtr p (body . castPtr)
+    setDeadline (RouteParams p) ms = withForeignPtr p $ \r -> c_setRouteDeadline r (fromIntegral ms)
+    setPriority (RouteParams p) prio = withForeignPtr p $ \r -> c_setRoutePriority r (fromIntegral prio)
+
+instance Params TableParams where
+    withParams (TableParams p) body = withForeignPtr p (body . castPtr)
+    setDeadline (TableParams p) ms = withForeignPtr p $ \t -> c_setTableDeadline t (fromIntegral ms)
+    setPriority (TableParams p) prio = withForeignPtr p $ \t -> c_setTablePriority t (fromIntegral prio)
+
+
+-- FFI
+--
+-- Calls that do real work (loading data, running a query) or may call back into Haskell are safe imports.
+-- Everything else is a short, non-blocking, non-reentrant call and imported unsafe, which skips the
+-- capability release and re-acquire a safe call pays. Bulk matrix copies are safe: they walk the response's
+-- JSON tree cell by cell, which for large tables takes long enough to stall every other Haskell thread.
+
+type ErrorOut = Ptr (Ptr ErrorHandle)
+
+foreign import ccall unsafe "osrmc_get_version"
+    getVersion :: CUInt
+
+foreign import ccall unsafe "osrmc_is_abi_compatible"
+    isABICompatible :: CInt
+
+
+foreign import ccall unsafe "osrmc_error_code"
+    c_errorCode :: Ptr ErrorHandle -> IO CString
+
+foreign import ccall unsafe "osrmc_error_message"
+    c_errorMessage :: Ptr ErrorHandle -> IO CString
+
+foreign import ccall unsafe "osrmc_error_destruct"
+    c_destructError :: Ptr ErrorHandle -> IO ()
+
+
+foreign import ccall safe "osrmc_config_construct"
+    c_constructConfig :: CString -> ErrorOut -> IO (Ptr Config)
+
+foreign import ccall "&osrmc_config_destruct"
+    p_destructConfig :: FunPtr (Ptr Config -> IO ())
+
+foreign import ccall safe "osrmc_osrm_construct"
+    c_constructOSRM :: Ptr Config -> ErrorOut -> IO (Ptr OSRM)
+
+foreign import ccall "&osrmc_osrm_destruct"
+    p_destructOSRM :: FunPtr (Ptr OSRM -> IO ())
+
+
+foreign import ccall unsafe "osrmc_params_add_coordinate"
+    c_addCoordinate :: Ptr ParamsHandle -> CFloat -> CFloat -> ErrorOut -> IO ()
+
+foreign import ccall unsafe "osrmc_params_add_coordinates"
+    c_addCoordinates :: Ptr ParamsHandle -> Ptr CFloat -> Ptr CFloat -> CSize -> ErrorOut -> IO ()
+
+
+foreign import ccall unsafe "osrmc_route_params_construct"
+    c_constructRouteParams :: ErrorOut -> IO (Ptr RouteParams)
+
+foreign import ccall "&osrmc_route_params_destruct"
+    p_destructRouteParams :: FunPtr (Ptr RouteParams -> IO ())
+
+foreign import ccall unsafe "osrmc_route_params_set_deadline"
+    c_setRouteDeadline :: Ptr RouteParams -> CUInt -> IO ()
+
+foreign import ccall unsafe "osrmc_route_params_set_priority"
+    c_setRoutePriority :: Ptr RouteParams -> CInt -> IO ()
+
+foreign import ccall safe "osrmc_route_visit"
+    c_routeVisit :: Ptr OSRM -> Ptr RouteParams -> Ptr VisitorHandle -> Ptr () -> ErrorOut -> IO ()
+
+type RouteCallback = Ptr () -> CSize -> CDouble -> CDouble -> IO ()
+
+foreign import ccall "wrapper"
+    mkRouteCallback :: RouteCallback -> IO (FunPtr RouteCallback)
+
+-- The library allocates and fills the visitor, so the binding never depends on the osrmc_visitor_t layout
+foreign import ccall unsafe "osrmc_visitor_construct"
+    c_constructVisitor :: ErrorOut -> IO (Ptr VisitorHandle)
+
+foreign import ccall unsafe "osrmc_visitor_destruct"
+    c_destructVisitor :: Ptr VisitorHandle -> IO ()
+
+foreign import ccall unsafe "osrmc_visitor_set_route"
+    c_setVisitorRoute :: Ptr VisitorHandle -> FunPtr RouteCallback -> IO ()
+
+
+foreign import ccall unsafe "osrmc_table_annotations_construct"
+    c_constructAnnotations :: ErrorOut -> IO (Ptr AnnotationsHandle)
+
+foreign import ccall unsafe "osrmc_table_annotations_destruct"
+    c_destructAnnotations :: Ptr AnnotationsHandle -> IO ()
+
+foreign import ccall unsafe "osrmc_table_annotations_enable_distance"
+    c_enableDistance :: Ptr AnnotationsHandle -> CBool -> ErrorOut -> IO ()
+
+foreign import ccall unsafe "osrmc_table_params_construct"
+    c_constructTableParams :: ErrorOut -> IO (Ptr TableParams)
+
+foreign import ccall "&osrmc_table_params_destruct"
+    p_destructTableParams :: FunPtr (Ptr TableParams -> IO ())
+
+foreign import ccall unsafe "osrmc_table_params_set_deadline"
+    c_setTableDeadline :: Ptr TableParams -> CUInt -> IO ()
+
+foreign import ccall unsafe "osrmc_table_params_set_priority"
+    c_setTablePriority :: Ptr TableParams -> CInt -> IO ()
+
+foreign import ccall unsafe "osrmc_table_params_set_annotations"
+    c_setAnnotations :: Ptr TableParams -> Ptr AnnotationsHandle -> ErrorOut -> IO ()
+
+foreign import ccall safe "osrmc_table"
+    c_table :: Ptr OSRM -> Ptr TableParams -> ErrorOut -> IO (Ptr TableResponse)
+
+foreign import ccall "&osrmc_table_response_destruct"
+    p_destructTableResponse :: FunPtr (Ptr TableResponse -> IO ())
+
+foreign import ccall unsafe "osrmc_table_response_rows"
+    c_tableRows :: Ptr TableResponse -> ErrorOut -> IO CSize
+
+foreign import ccall unsafe "osrmc_table_response_columns"
+    c_tableColumns :: Ptr TableResponse -> ErrorOut -> IO CSize
+
+foreign import ccall safe "osrmc_table_response_durations"
+    c_tableDurations :: Ptr TableResponse -> Ptr CFloat -> CSize -> ErrorOut -> IO ()
+
+foreign import ccall safe "osrmc_table_response_distances"
+    c_tableDistances :: Ptr TableResponse -> Ptr CFloat -> CSize -> ErrorOut -> IO ()
+
+
+-- Error Handling
+
+data OSRMError = OSRMError { errorCode    :: String
+                           , errorMessage :: String } deriving (Show)
+
+instance Exception OSRMError
+
+-- Passes an error out-parameter and rethrows a reported error as OSRMError.
+-- The thread-local osrmc_last_status channel is not used: Haskell threads migrate between OS threads.
+checked :: (ErrorOut -> IO a) -> IO a
+checked call = alloca $ \out -> do
+    poke out nullPtr
+    result <- call out
+    err <- peek out
+    if err == nullPtr
+      then return result
+      else do
+        code <- peekCString =<< c_errorCode err
+        message <- peekCString =<< c_errorMessage err
+        c_destructError err
+        throwIO (OSRMError code message)
+
+
+-- Haskell Library Interface
+
+data Coordinate = Coordinate { longitude :: Float
+                             , latitude  :: Float} deriving (Show)
+
+data RouteSummary = RouteSummary { distance :: Double
+                                 , duration :: Double } deriving (Show)
+
+-- Row-major rows x columns matrix; unreachable pairs are Infinity.
+data Table = Table { tableRows    :: !Int
+                   , tableColumns :: !Int
+                   , tableCells   :: !(VS.Vector Float) } deriving (Show)
+
+
+newConfig :: String -> IO Config
+newConfig basePath = withCString basePath $ \path -> do
+    config <- checked $ c_constructConfig path
+    Config <$> newForeignPtr p_destructConfig config
+
+newOSRM :: Config -> IO OSRM
+newOSRM (Config config) = withForeignPtr config $ \c -> do
+    osrm <- checked $ c_constructOSRM c
+    OSRM <$> newForeignPtr p_destructOSRM osrm
+
+closeOSRM :: OSRM -> IO ()
+closeOSRM = finalizeForeignPtr . getOSRM
+
+
+addCoordinate :: Params p => p -> Coordinate -> IO ()
+addCoordinate params (Coordinate lon lat) = withParams params $ \p ->
+    checked $ c_addCoordinate p (realToFrac lon) (realToFrac lat)
+
+-- Appends all coordinates in one FFI call; longitudes and latitudes must have the same length.
+addCoordinates :: Params p => p -> VS.Vector Float -> VS.Vector Float -> IO ()
+addCoordinates params lons lats = do
+    when (VS.length lons /= VS.length lats) $
+        throwIO (OSRMError "InvalidValue" "Longitudes and latitudes differ in length")
+    withParams params $ \p ->
+        VS.unsafeWith lons $ \lonPtr ->
+        VS.unsafeWith lats $ \latPtr ->
+            checked $ c_addCoordinates p (castPtr lonPtr) (castPtr latPtr) (fromIntegral (VS.length lons))
+
+
+newRouteParams :: IO RouteParams
+newRouteParams = do
+    params <- checked c_constructRouteParams
+    RouteParams <$> newForeignPtr p_destructRouteParams params
+
+-- Distance and duration of the first route, streamed through the visitor so no JSON tree is built.
+route :: OSRM -> RouteParams -> IO RouteSummary
+route (OSRM osrm) (RouteParams params) = do
+    found <- newIORef Nothing
+
+    let onRoute _ index dist dura =
+            when (index == 0) $ writeIORef found (Just (RouteSummary (realToFrac dist) (realToFrac dura)))
+
+    bracket (mkRouteCallback onRoute) freeHaskellFunPtr $ \callback ->
+        bracket (checked c_constructVisitor) c_destructVisitor $ \visitor -> do
+            c_setVisitorRoute visitor callback
+
+            withForeignPtr osrm $ \o ->
+                withForeignPtr params $ \p ->
+                    checked $ c_routeVisit o p visitor nullPtr
+
+    maybe (throwIO (OSRMError "NoRoute" "Route service returned no route")) return =<< readIORef found
+
+
+newTableParams :: IO TableParams
+newTableParams = do
+    params <- checked c_constructTableParams
+    TableParams <$> newForeignPtr p_destructTableParams params
+
+enableDistances :: TableParams -> Bool -> IO ()
+enableDistances (TableParams params) enable =
+    bracket (checked c_constructAnnotations) c_destructAnnotations $ \annotations -> do
+        checked $ c_enableDistance annotations (if enable then 1 else 0)
+        withForeignPtr params $ \p -> checked $ c_setAnnotations p annotations
+
+table :: OSRM -> TableParams -> IO TableResponse
+table (OSRM osrm) (TableParams params) =
+    withForeignPtr osrm $ \o ->
+        withForeignPtr params $ \p -> do
+            response <- checked $ c_table o p
+            TableResponse <$> newForeignPtr p_destructTableResponse response
+
+durations :: TableResponse -> IO Table
+durations = extractTable c_tableDurations
+
+distances :: TableResponse -> IO Table
+distances = extractTable c_tableDistances
+
+-- Sizes a pinned buffer once and lets the library fill the whole matrix in a single call.
+extractTable :: (Ptr TableResponse -> Ptr CFloat -> CSize -> ErrorOut -> IO ()) -> TableResponse -> IO Table
+extractTable fill (TableResponse response) = withForeignPtr response $ \r -> do
+    rows <- fromIntegral <$> checked (c_tableRows r)
+    columns <- fromIntegral <$> checked (c_tableColumns r)
+
+    cells <- VSM.new (rows * columns)
+    VSM.unsafeWith cells $ \out -> checked $ fill r (castPtr out) (fromIntegral (rows * columns))
+
+    Table rows columns <$> VS.unsafeFreeze cells
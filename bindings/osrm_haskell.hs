@@ -1,122 +1,46 @@
-{-# LANGUAGE ForeignFunctionInterface #-}
-{-# LANGUAGE OverloadedStrings #-}
 module Main where
 
-import Foreign.C
-import Foreign.Ptr
+import OSRM
 
-import Data.Text (Text, unpack)
 import Data.Monoid ((<>))
-import Control.Exception (bracket)
-import Control.Monad.IO.Class (liftIO)
-import Control.Monad.Trans.Cont (ContT(..), runContT)
-import Control.Applicative ((<$>), (<*>))
+import Data.List (intercalate)
+import System.Environment (getArgs)
 
+import qualified Data.Vector.Storable as VS
 
--- Opaque Types
 
-newtype Config = Config { getConfig :: Ptr Config }
-newtype OSRM = OSRM { getOSRM :: Ptr OSRM }
-newtype RouteParams = RouteParams { getRouteParams :: Ptr RouteParams }
-newtype RouteResponse = RouteResponse { getRouteResponse :: Ptr RouteResponse }
-
--- ABI Stability
-
-foreign import ccall "osrmc_get_version"
-    getVersion :: CUInt
-
-foreign import ccall "osrmc_is_abi_compatible"
-    isABICompatible :: CInt
-
--- API
-
-foreign import ccall "osrmc_config_construct"
-    constructConfig :: CString -> IO Config
-
-foreign import ccall "osrmc_config_destruct"
-    destructConfig :: Config -> IO ()
-
-
-foreign import ccall "osrmc_osrm_construct"
-    constructOSRM :: Config -> IO OSRM
-
-foreign import ccall "osrmc_osrm_destruct"
-    destructOSRM :: OSRM -> IO ()
-
-
-foreign import ccall "osrmc_route_params_construct"
-    constructRouteParams :: IO RouteParams
-
-foreign import ccall "osrmc_route_params_destruct"
-    destructRouteParams :: RouteParams -> IO ()
-
-foreign import ccall "osrmc_params_add_coordinate"
-    addCoordinate :: RouteParams -> Float -> Float -> IO ()
-
-
-foreign import ccall "osrmc_route"
-    route :: OSRM -> RouteParams -> IO RouteResponse
-
-foreign import ccall "osrmc_route_response_destruct"
-    destructRouteResponse :: RouteResponse -> IO ()
-
-foreign import ccall "osrmc_route_response_distance"
-    distance :: RouteResponse -> IO Float
-
-foreign import ccall "osrmc_route_response_duration"
-    duration :: RouteResponse -> IO Float
-
-
--- Haskell Library Interface
-
-data Coordinate = Coordinate { longitude :: Float
-                             , latitude  :: Float} deriving (Show)
-
-
-withConfig :: Text -> (Config -> IO ()) -> IO ()
-withConfig basePath body = bracket construct destruct body
-  where construct = withCString (unpack basePath) $ constructConfig
-        destruct  = destructConfig
-
-withOSRM :: Config -> (OSRM -> IO ()) -> IO ()
-withOSRM config body = bracket construct destruct body
-  where construct = constructOSRM config
-        destruct  = destructOSRM
-
-withRouteParams :: (RouteParams -> IO ()) -> IO ()
-withRouteParams body = bracket construct destruct body
-  where construct = constructRouteParams
-        destruct  = destructRouteParams
-
-withRoute :: OSRM -> RouteParams -> (RouteResponse -> IO ()) -> IO ()
-withRoute osrm params body = bracket construct destruct body
-  where construct = route osrm params
-        destruct  = destructRouteResponse
+main :: IO ()
+main = do
+    args <- getArgs
+    let base = case args of (path : _) -> path
+                            _          -> "/tmp/osrm-backend/test/data/monaco.osrm"
 
+    let start = Coordinate { longitude=7.419758, latitude=43.731142 }
+    let end   = Coordinate { longitude=7.419505, latitude=43.736825 }
 
--- TODO(daniel-j-h):
---  - Error handling, EitherT
---  - Nice abstractions
+    osrm <- newOSRM =<< newConfig base
 
+    params <- newRouteParams
+    addCoordinate params start
+    addCoordinate params end
 
-main = do
-    let base  = "/tmp/osrm-backend/test/data/monaco.osrm"
+    summary <- route osrm params
 
-    let start = Coordinate { longitude=7.419758, latitude=43.731142 }
-    let end   = Coordinate { longitude=7.419505, latitude=43.736825 }
+    putStrLn $ "Distance: " <> show (distance summary) <> " meters"
+    putStrLn $ "Duration: " <> show (duration summary) <> " seconds"
 
-    flip runContT return $ do
-        config <- ContT $ withConfig base
-        osrm   <- ContT $ withOSRM config
+    -- All coordinates go in with one call and the matrix comes back as a single storable vector
+    let lons = VS.fromList [7.419758, 7.419505, 7.426426, 7.413011, 7.421392]
+    let lats = VS.fromList [43.731142, 43.736825, 43.739235, 43.734293, 43.738049]
 
-        params <- ContT $ withRouteParams
-        liftIO $ addCoordinate params (longitude start) (latitude start)
-        liftIO $ addCoordinate params (longitude end)   (latitude end)
+    tableParams <- newTableParams
+    addCoordinates tableParams lons lats
 
-        response <- ContT $ withRoute osrm params
+    matrix <- durations =<< table osrm tableParams
 
-        dist <- liftIO $ distance response
-        dura <- liftIO $ duration response
+    putStrLn "Table"
+    mapM_ (putStrLn . intercalate "\t" . map (\d -> show (round d :: Int) <> "s") . VS.toList)
+          [ VS.slice (row * tableColumns matrix) (tableColumns matrix) (tableCells matrix)
+          | row <- [0 .. tableRows matrix - 1] ]
 
-        liftIO . putStrLn $ "Distance: " <> (show dist) <> " meters"
-        liftIO . putStrLn $ "Duration: " <> (show dura) <> " seconds"
+    closeOSRM osrm
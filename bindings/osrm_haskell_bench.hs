@@ -0,0 +1,87 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+module Main where
+
+import OSRM
+
+import Foreign.C
+import Foreign.Ptr
+import Foreign.ForeignPtr (withForeignPtr)
+import System.Environment (getArgs, withArgs)
+
+import qualified Data.Vector.Storable as VS
+import qualified Data.Vector.Unboxed as VU
+
+import Criterion.Main
+
+
+-- Per-element baselines: what the binding did before, one safe FFI call per coordinate and per cell
+
+foreign import ccall safe "osrmc_params_add_coordinate"
+    safeAddCoordinate :: Ptr () -> CFloat -> CFloat -> Ptr () -> IO ()
+
+foreign import ccall safe "osrmc_table_response_duration"
+    safeDuration :: Ptr TableResponse -> CULong -> CULong -> Ptr () -> IO CFloat
+
+
+addCoordinatesEach :: TableParams -> VS.Vector Float -> VS.Vector Float -> IO ()
+addCoordinatesEach params lons lats = withParams params $ \p ->
+    VS.zipWithM_ (\lon lat -> safeAddCoordinate (castPtr p) (realToFrac lon) (realToFrac lat) nullPtr) lons lats
+
+durationsEach :: TableResponse -> Int -> IO (VU.Vector Float)
+durationsEach (TableResponse response) size = withForeignPtr response $ \r ->
+    VU.generateM (size * size) $ \i -> do
+        let (from, to) = i `quotRem` size
+        realToFrac <$> safeDuration r (fromIntegral from) (fromIntegral to) nullPtr
+
+
+-- Coordinates on a small grid over Monaco, so that every pair is routable
+grid :: Int -> (VS.Vector Float, VS.Vector Float)
+grid size = (VS.generate size lon, VS.generate size lat)
+  where lon i = 7.413 + 0.0015 * fromIntegral (i `rem` 8)
+        lat i = 43.731 + 0.0010 * fromIntegral (i `quot` 8 `rem` 8)
+
+tableOf :: OSRM -> (TableParams -> IO ()) -> IO TableResponse
+tableOf osrm fill = do
+    params <- newTableParams
+    fill params
+    table osrm params
+
+
+-- Usage: osrm_haskell_bench base.osrm [criterion options]
+main :: IO ()
+main = do
+    args <- getArgs
+    let (base, rest) = case args of (path : more) -> (path, more)
+                                    _             -> ("/tmp/osrm-backend/test/data/monaco.osrm", [])
+
+    osrm <- newOSRM =<< newConfig base
+
+    let sizes = [10, 50, 100]
+
+    responses <- mapM (\size -> let (lons, lats) = grid size
+                                in tableOf osrm (\p -> addCoordinates p lons lats)) sizes
+
+    withArgs rest $ defaultMain
+      [ bgroup "coordinates"
+          [ bgroup (show size)
+              [ bench "each/safe" $ whnfIO (newTableParams >>= \p -> addCoordinatesEach p lons lats)
+              , bench "bulk"      $ whnfIO (newTableParams >>= \p -> addCoordinates p lons lats)
+              ]
+          | size <- sizes, let (lons, lats) = grid size ]
+
+      , bgroup "matrix"
+          [ bgroup (show size)
+              [ bench "each/safe" $ nfIO (durationsEach response size)
+              , bench "bulk"      $ whnfIO (tableCells <$> durations response)
+              ]
+          | (size, response) <- zip sizes responses ]
+
+      , bgroup "table"
+          [ bench (show size) $ whnfIO $ do
+              let (lons, lats) = grid size
+              response <- tableOf osrm (\p -> addCoordinates p lons lats)
+              tableCells <$> durations response
+          | size <- sizes ]
+      ]
+
+    closeOSRM osrm
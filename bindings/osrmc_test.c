@@ -0,0 +1,1058 @@
+#include <Python.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <osrmc/osrmc.h>
+
+
+/* Exercises the library against a real dataset, e.g. monaco.osrm.
+ * Each test prints its outcome; failed checks are listed on stderr. */
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                                        \
+  do {                                                                                                          \
+    if (!(condition)) {                                                                                         \
+      fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);                                      \
+      failures += 1;                                                                                            \
+    }                                                                                                           \
+  } while (0)
+
+/* Expects the call to have succeeded, reports and releases the error otherwise */
+static int ok(osrmc_error_t* error) {
+  if (*error == NULL)
+    return 1;
+
+  fprintf(stderr, "Error: code=%s, message=%s\n", osrmc_error_code(*error), osrmc_error_message(*error));
+  osrmc_error_destruct(*error);
+  *error = NULL;
+  failures += 1;
+  return 0;
+}
+
+/* Status of a failed call, OSRMC_OK if it succeeded; releases the error */
+static osrmc_status_t status_of(osrmc_error_t* error) {
+  osrmc_status_t status = OSRMC_OK;
+
+  if (*error) {
+    status = osrmc_error_status(*error);
+    osrmc_error_destruct(*error);
+    *error = NULL;
+  }
+
+  return status;
+}
+
+/* Prints a test's outcome given the failure count at its start */
+static void report(const char* name, int before) { printf("%s: %s\n", name, failures == before ? "ok" : "FAILED"); }
+
+static int near(float lhs, float rhs) { return (isinf(lhs) && isinf(rhs)) || fabsf(lhs - rhs) <= 0.05f; }
+
+/* Locations in Monaco */
+enum { COUNT = 6 };
+static const float longitudes[COUNT] = {7.419758f, 7.419505f, 7.421511f, 7.416570f, 7.426000f, 7.412700f};
+static const float latitudes[COUNT] = {43.731142f, 43.736825f, 43.734337f, 43.731340f, 43.739400f, 43.728500f};
+
+/* Exact Table over the given coordinate indices with durations and distances */
+static osrmc_table_response_t exact_table(osrmc_osrm_t osrm, const size_t* indices, size_t count) {
+  osrmc_error_t error = NULL;
+  osrmc_table_annotations_t annotations;
+  osrmc_table_params_t params;
+  osrmc_table_response_t response = NULL;
+  size_t i;
+
+  annotations = osrmc_table_annotations_construct(&error);
+  osrmc_table_annotations_enable_distance(annotations, true, &error);
+  params = osrmc_table_params_construct(&error);
+  osrmc_table_params_set_annotations(params, annotations, &error);
+
+  for (i = 0; i < count; ++i)
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[indices[i]], latitudes[indices[i]], &error);
+
+  if (ok(&error))
+    response = osrmc_table(osrm, params, &error);
+  ok(&error);
+
+  osrmc_table_params_destruct(params);
+  osrmc_table_annotations_destruct(annotations);
+  return response;
+}
+
+static const size_t all[COUNT] = {0, 1, 2, 3, 4, 5};
+
+
+/* Status channel and bulk table copies */
+
+static void test_table(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  osrmc_table_response_t response;
+  float cells[COUNT * COUNT];
+  size_t rows, columns, from, to;
+  int before = failures;
+
+  response = exact_table(osrm, all, COUNT);
+  if (!response)
+    return;
+
+  rows = osrmc_table_response_rows(response, &error);
+  columns = osrmc_table_response_columns(response, &error);
+  ok(&error);
+  CHECK(rows == COUNT && columns == COUNT);
+
+  /* Too small a buffer fails without writing */
+  cells[0] = -1.f;
+  osrmc_table_response_durations(response, cells, COUNT * COUNT - 1, &error);
+  CHECK(status_of(&error) == OSRMC_ERROR_INVALID_VALUE);
+  CHECK(cells[0] == -1.f);
+
+  osrmc_table_response_durations(response, cells, COUNT * COUNT, &error);
+  ok(&error);
+  for (from = 0; from < COUNT; ++from)
+    for (to = 0; to < COUNT; ++to)
+      CHECK(near(cells[from * COUNT + to], osrmc_table_response_duration(response, from, to, NULL)));
+
+  osrmc_table_response_distances(response, cells, COUNT * COUNT, &error);
+  ok(&error);
+  for (from = 0; from < COUNT; ++from)
+    for (to = 0; to < COUNT; ++to)
+      CHECK(near(cells[from * COUNT + to], osrmc_table_response_distance(response, from, to, NULL)));
+
+  /* Without an error object failures land in the thread's status and stay there until cleared */
+  osrmc_clear_status();
+  CHECK(isinf(osrmc_table_response_duration(response, COUNT, 0, NULL)));
+  CHECK(osrmc_last_status() != OSRMC_OK);
+  CHECK(strlen(osrmc_last_message()) > 0);
+
+  osrmc_table_response_duration(response, 0, 1, NULL);
+  CHECK(osrmc_last_status() != OSRMC_OK);
+
+  osrmc_clear_status();
+  CHECK(osrmc_last_status() == OSRMC_OK);
+
+  osrmc_table_response_destruct(response);
+  report("table", before);
+}
+
+
+/* Deduplicated Table against the plain one */
+
+static void test_deduplicated(osrmc_osrm_t osrm) {
+  static const size_t indices[] = {0, 1, 0, 2, 1};
+  enum { DUPLICATED = sizeof(indices) / sizeof(indices[0]) };
+
+  osrmc_error_t error = NULL;
+  osrmc_table_params_t params;
+  osrmc_table_response_t exact, response;
+  size_t i, from, to, unique = 0;
+  int before = failures;
+
+  exact = exact_table(osrm, indices, DUPLICATED);
+  if (!exact)
+    return;
+
+  params = osrmc_table_params_construct(&error);
+  for (i = 0; i < DUPLICATED; ++i)
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[indices[i]], latitudes[indices[i]], &error);
+
+  response = osrmc_table_deduplicated(osrm, params, 1.f, 0, &unique, &error);
+  if (ok(&error)) {
+    CHECK(unique == 3);
+
+    for (from = 0; from < DUPLICATED; ++from)
+      for (to = 0; to < DUPLICATED; ++to)
+        CHECK(near(osrmc_table_response_duration(response, from, to, NULL),
+                   osrmc_table_response_duration(exact, from, to, NULL)));
+
+    osrmc_table_response_destruct(response);
+  }
+
+  osrmc_table_params_destruct(params);
+  osrmc_table_response_destruct(exact);
+  report("deduplicated", before);
+}
+
+
+/* Incremental matrix: grow, then compact, always matching an exact Table over the same coordinates */
+
+static void check_matrix(osrmc_matrix_t matrix, osrmc_osrm_t osrm, const size_t* indices, size_t count) {
+  osrmc_table_response_t exact;
+  const float* durations;
+  const float* distances;
+  size_t from, to;
+
+  CHECK(osrmc_matrix_size(matrix) == count);
+
+  exact = exact_table(osrm, indices, count);
+  if (!exact)
+    return;
+
+  durations = osrmc_matrix_durations(matrix);
+  distances = osrmc_matrix_distances(matrix);
+  CHECK(durations != NULL && distances != NULL);
+
+  for (from = 0; durations && distances && from < count; ++from)
+    for (to = 0; to < count; ++to) {
+      CHECK(near(durations[from * count + to], osrmc_table_response_duration(exact, from, to, NULL)));
+      CHECK(near(distances[from * count + to], osrmc_table_response_distance(exact, from, to, NULL)));
+    }
+
+  osrmc_table_response_destruct(exact);
+}
+
+static void test_matrix(osrmc_osrm_t osrm) {
+  static const size_t removed[] = {1, 4};
+  static const size_t kept[] = {0, 2, 3, 5};
+
+  osrmc_error_t error = NULL;
+  osrmc_table_annotations_t annotations;
+  osrmc_matrix_t matrix;
+  int before = failures;
+
+  annotations = osrmc_table_annotations_construct(&error);
+  osrmc_table_annotations_enable_distance(annotations, true, &error);
+  matrix = osrmc_matrix_construct(osrm, annotations, &error);
+  osrmc_table_annotations_destruct(annotations);
+  if (!ok(&error))
+    return;
+
+  CHECK(osrmc_matrix_size(matrix) == 0);
+
+  osrmc_matrix_add_coordinates(matrix, longitudes, latitudes, 3, &error);
+  if (ok(&error))
+    check_matrix(matrix, osrm, all, 3);
+
+  osrmc_matrix_add_coordinates(matrix, longitudes + 3, latitudes + 3, COUNT - 3, &error);
+  if (ok(&error))
+    check_matrix(matrix, osrm, all, COUNT);
+
+  osrmc_matrix_remove_coordinates(matrix, removed, 2, &error);
+  if (ok(&error))
+    check_matrix(matrix, osrm, kept, 4);
+
+  /* Out of range indices leave the matrix untouched */
+  osrmc_matrix_remove_coordinates(matrix, removed + 1, 1, &error);
+  CHECK(status_of(&error) != OSRMC_OK);
+  CHECK(osrmc_matrix_size(matrix) == 4);
+
+  osrmc_matrix_destruct(matrix);
+  report("matrix", before);
+}
+
+
+/* Approximate matrix: rows and single durations agree, error estimates are sane */
+
+static void test_approx_table(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  osrmc_approx_table_t table;
+  float row[COUNT];
+  size_t from, to;
+  int before = failures;
+
+  table = osrmc_approx_table_construct(osrm, longitudes, latitudes, COUNT, 4, COUNT, &error);
+  if (!ok(&error))
+    return;
+
+  CHECK(osrmc_approx_table_cells(table) >= 1 && osrmc_approx_table_cells(table) <= 4);
+  CHECK(osrmc_approx_table_error_mean(table) >= 0.f);
+  CHECK(osrmc_approx_table_error_max(table) >= osrmc_approx_table_error_mean(table));
+
+  for (from = 0; from < COUNT; ++from) {
+    osrmc_approx_table_row(table, from, row, &error);
+    if (!ok(&error))
+      continue;
+
+    CHECK(row[from] == 0.f);
+    for (to = 0; to < COUNT; ++to)
+      CHECK(near(row[to], osrmc_approx_table_duration(table, from, to, NULL)));
+  }
+
+  osrmc_approx_table_duration(table, COUNT, 0, &error);
+  CHECK(status_of(&error) != OSRMC_OK);
+
+  osrmc_approx_table_destruct(table);
+  report("approx table", before);
+}
+
+
+/* Streaming responses: every begin has its end, typed shortcuts fire once per object */
+
+typedef struct {
+  int depth;
+  int unbalanced;
+  size_t keys;
+  size_t routes;
+  size_t legs;
+  size_t rows;
+  size_t cells;
+} events_t;
+
+static void events_begin(void* data) { ((events_t*)data)->depth += 1; }
+
+static void events_end(void* data) {
+  events_t* events = (events_t*)data;
+  events->depth -= 1;
+  if (events->depth < 0)
+    events->unbalanced = 1;
+}
+
+static void events_key(void* data, const char* key, size_t length) {
+  (void)key;
+  (void)length;
+  ((events_t*)data)->keys += 1;
+}
+
+static void events_route(void* data, size_t route, double distance, double duration) {
+  (void)route;
+  (void)distance;
+  (void)duration;
+  ((events_t*)data)->routes += 1;
+}
+
+static void events_leg(void* data, size_t route, size_t leg, double distance, double duration) {
+  (void)route;
+  (void)leg;
+  (void)distance;
+  (void)duration;
+  ((events_t*)data)->legs += 1;
+}
+
+static void events_table_row(void* data, const char* annotation, size_t row, const float* values, size_t count) {
+  (void)annotation;
+  (void)row;
+  (void)values;
+  ((events_t*)data)->rows += 1;
+  ((events_t*)data)->cells += count;
+}
+
+static void test_visitor(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  osrmc_visitor_t visitor;
+  osrmc_visitor_t* heap;
+  osrmc_table_annotations_t annotations;
+  osrmc_table_params_t table_params;
+  osrmc_route_params_t route_params;
+  events_t events;
+  size_t i;
+  int before = failures;
+
+  memset(&visitor, 0, sizeof(visitor));
+  visitor.begin_object = events_begin;
+  visitor.end_object = events_end;
+  visitor.begin_array = events_begin;
+  visitor.end_array = events_end;
+  visitor.key = events_key;
+  visitor.route = events_route;
+  visitor.leg = events_leg;
+
+  route_params = osrmc_route_params_construct(&error);
+  for (i = 0; i < 3; ++i)
+    osrmc_params_add_coordinate((osrmc_params_t)route_params, longitudes[i], latitudes[i], &error);
+  ok(&error);
+
+  memset(&events, 0, sizeof(events));
+  osrmc_route_visit(osrm, route_params, &visitor, &events, &error);
+  if (ok(&error)) {
+    CHECK(events.depth == 0 && !events.unbalanced);
+    CHECK(events.keys > 0);
+    CHECK(events.routes == 1);
+    CHECK(events.legs == 2);
+  }
+
+  /* Bindings that can not lay out the struct use the heap visitor */
+  heap = osrmc_visitor_construct(&error);
+  if (ok(&error)) {
+    osrmc_visitor_set_route(heap, events_route);
+
+    memset(&events, 0, sizeof(events));
+    osrmc_route_visit(osrm, route_params, heap, &events, &error);
+    if (ok(&error))
+      CHECK(events.routes == 1);
+
+    osrmc_visitor_destruct(heap);
+  }
+
+  osrmc_route_params_destruct(route_params);
+
+  annotations = osrmc_table_annotations_construct(&error);
+  osrmc_table_annotations_enable_distance(annotations, true, &error);
+  table_params = osrmc_table_params_construct(&error);
+  osrmc_table_params_set_annotations(table_params, annotations, &error);
+  osrmc_params_add_coordinates((osrmc_params_t)table_params, longitudes, latitudes, 4, &error);
+  ok(&error);
+
+  /* Generic events for the matrices */
+  memset(&events, 0, sizeof(events));
+  osrmc_table_visit(osrm, table_params, &visitor, &events, &error);
+  if (ok(&error)) {
+    CHECK(events.depth == 0 && !events.unbalanced);
+    CHECK(events.rows == 0);
+  }
+
+  /* Row by row, still bracketed */
+  visitor.table_row = events_table_row;
+  memset(&events, 0, sizeof(events));
+  osrmc_table_visit(osrm, table_params, &visitor, &events, &error);
+  if (ok(&error)) {
+    CHECK(events.depth == 0 && !events.unbalanced);
+    CHECK(events.rows == 2 * 4);
+    CHECK(events.cells == 2 * 4 * 4);
+  }
+
+  osrmc_table_params_destruct(table_params);
+  osrmc_table_annotations_destruct(annotations);
+  report("visitor", before);
+}
+
+
+/* Admission control under concurrent expensive queries */
+
+enum { THREADS = 8, QUERIES = 20 };
+
+typedef struct {
+  osrmc_osrm_t osrm;
+  unsigned deadline;
+  int priority;
+  size_t results[OSRMC_ERROR_OVERLOADED + 1];
+} admission_job_t;
+
+static void* admission_worker(void* data) {
+  admission_job_t* job = (admission_job_t*)data;
+  osrmc_error_t error = NULL;
+  osrmc_table_params_t params;
+  osrmc_table_response_t response;
+  osrmc_status_t status;
+  int i;
+
+  for (i = 0; i < QUERIES; ++i) {
+    params = osrmc_table_params_construct(&error);
+    osrmc_params_add_coordinates((osrmc_params_t)params, longitudes, latitudes, 3, &error);
+    osrmc_table_params_set_deadline(params, job->deadline);
+    osrmc_table_params_set_priority(params, job->priority);
+
+    response = NULL;
+    if (!error)
+      response = osrmc_table(job->osrm, params, &error);
+
+    status = status_of(&error);
+    if ((size_t)status < sizeof(job->results) / sizeof(job->results[0]))
+      job->results[status] += 1;
+
+    osrmc_table_response_destruct(response);
+    osrmc_table_params_destruct(params);
+  }
+
+  return NULL;
+}
+
+/* Runs THREADS x QUERIES 3 x 3 Tables, returns how many ended with each status */
+static void run_admission(osrmc_osrm_t osrm, unsigned deadline, size_t* results) {
+  pthread_t threads[THREADS];
+  admission_job_t jobs[THREADS];
+  size_t i, status;
+
+  memset(jobs, 0, sizeof(jobs));
+  memset(results, 0, sizeof(jobs[0].results));
+
+  for (i = 0; i < THREADS; ++i) {
+    jobs[i].osrm = osrm;
+    jobs[i].deadline = deadline;
+    jobs[i].priority = (int)(i % 3);
+    CHECK(pthread_create(&threads[i], NULL, admission_worker, &jobs[i]) == 0);
+  }
+
+  for (i = 0; i < THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+    for (status = 0; status < sizeof(jobs[i].results) / sizeof(jobs[i].results[0]); ++status)
+      results[status] += jobs[i].results[status];
+  }
+
+  /* Every slot is given back, nobody is left queued */
+  CHECK(osrmc_osrm_queue_depth(osrm) == 0);
+  CHECK(osrmc_osrm_running(osrm) == 0);
+}
+
+/* A Table over a GRID x GRID lattice spanning Monaco, large enough to keep a slot busy for a while */
+enum { GRID = 12, SLOW = 8, SLOW_COST = GRID * GRID * GRID * GRID };
+
+typedef struct {
+  osrmc_osrm_t osrm;
+  unsigned deadline;
+  int priority;
+  osrmc_status_t status;
+  size_t finished; /* completion order, starting at one */
+} slow_job_t;
+
+/* Guards progress that other threads poll: completion order and done flags */
+static pthread_mutex_t progress = PTHREAD_MUTEX_INITIALIZER;
+static size_t slow_finished = 0;
+
+static void* slow_worker(void* data) {
+  slow_job_t* job = (slow_job_t*)data;
+  osrmc_error_t error = NULL;
+  osrmc_table_params_t params;
+  osrmc_table_response_t response = NULL;
+  size_t x, y;
+
+  params = osrmc_table_params_construct(&error);
+  for (y = 0; y < GRID; ++y)
+    for (x = 0; x < GRID; ++x)
+      osrmc_params_add_coordinate((osrmc_params_t)params, 7.410f + 0.025f * x / GRID, 43.726f + 0.022f * y / GRID,
+                                  &error);
+  osrmc_table_params_set_deadline(params, job->deadline);
+  osrmc_table_params_set_priority(params, job->priority);
+
+  if (!error)
+    response = osrmc_table(job->osrm, params, &error);
+  job->status = status_of(&error);
+
+  pthread_mutex_lock(&progress);
+  job->finished = ++slow_finished;
+  pthread_mutex_unlock(&progress);
+
+  osrmc_table_response_destruct(response);
+  osrmc_table_params_destruct(params);
+  return NULL;
+}
+
+/* Polls until running and queued reach the given counts; fails after a second */
+static int await_admission(osrmc_osrm_t osrm, size_t running, size_t queued) {
+  struct timespec pause = {0, 100000};
+  int i;
+
+  for (i = 0; i < 10000; ++i) {
+    if (osrmc_osrm_running(osrm) == running && osrmc_osrm_queue_depth(osrm) == queued)
+      return 1;
+    nanosleep(&pause, NULL);
+  }
+
+  return 0;
+}
+
+/* Starts the jobs one after another with a single slot: the first one runs, every further one is queued before the
+ * next starts. Returns how many threads were started; queued tells whether all of them got there in time. */
+static size_t start_slow(slow_job_t* jobs, pthread_t* threads, size_t count, int* queued) {
+  size_t started = 0;
+
+  *queued = 0;
+  osrmc_osrm_set_admission(jobs[0].osrm, 1, SLOW_COST, 64);
+
+  while (started < count) {
+    if (pthread_create(&threads[started], NULL, slow_worker, &jobs[started]) != 0)
+      return started;
+
+    started += 1;
+    if (!await_admission(jobs[0].osrm, 1, started - 1))
+      return started;
+  }
+
+  *queued = 1;
+  return started;
+}
+
+/* Queues slow Tables behind one holding the only slot, then raises the limit: all of them have to start at once.
+ * A waiter that gets admitted must wake the one behind it, or that one idles until a running query finishes. */
+static void test_admission_handoff(osrmc_osrm_t osrm) {
+  slow_job_t jobs[SLOW];
+  pthread_t threads[SLOW];
+  size_t i, started;
+  int queued;
+
+  memset(jobs, 0, sizeof(jobs));
+  for (i = 0; i < SLOW; ++i)
+    jobs[i].osrm = osrm;
+
+  started = start_slow(jobs, threads, SLOW, &queued);
+
+  if (queued) {
+    osrmc_osrm_set_admission(osrm, SLOW, SLOW_COST, 64);
+    CHECK(await_admission(osrm, SLOW, 0));
+  }
+
+  for (i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+    CHECK(jobs[i].status == OSRMC_OK);
+  }
+
+  if (!queued)
+    fprintf(stderr, "Skipping admission handoff: the first query finished before the others queued\n");
+}
+
+/* Behind the query holding the only slot, a later query with a higher priority overtakes an earlier one */
+static void test_admission_order(osrmc_osrm_t osrm) {
+  slow_job_t jobs[3];
+  pthread_t threads[3];
+  size_t i, started;
+  int queued;
+
+  memset(jobs, 0, sizeof(jobs));
+  for (i = 0; i < 3; ++i)
+    jobs[i].osrm = osrm;
+  jobs[2].priority = 5;
+
+  started = start_slow(jobs, threads, 3, &queued);
+
+  for (i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+    CHECK(jobs[i].status == OSRMC_OK);
+  }
+
+  if (queued)
+    CHECK(jobs[2].finished < jobs[1].finished);
+  else
+    fprintf(stderr, "Skipping admission order: the first query finished before the others queued\n");
+}
+
+static double seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* A query that can not get the only slot before its deadline fails instead of waiting for it */
+static void test_admission_deadline(osrmc_osrm_t osrm) {
+  slow_job_t jobs[2];
+  pthread_t thread;
+  double elapsed;
+  int queued;
+
+  memset(jobs, 0, sizeof(jobs));
+  jobs[0].osrm = jobs[1].osrm = osrm;
+  jobs[1].deadline = 1;
+
+  if (start_slow(jobs, &thread, 1, &queued) == 0)
+    return;
+
+  elapsed = seconds();
+  slow_worker(&jobs[1]);
+  elapsed = seconds() - elapsed;
+
+  pthread_join(thread, NULL);
+  CHECK(jobs[0].status == OSRMC_OK);
+
+  /* Succeeding is fine only if the slot freed up right away */
+  if (queued)
+    CHECK(jobs[1].status == OSRMC_ERROR_DEADLINE_EXCEEDED || (jobs[1].status == OSRMC_OK && elapsed < 0.02));
+  else
+    fprintf(stderr, "Skipping admission deadline: the first query finished before the second started\n");
+}
+
+static void test_admission(osrmc_osrm_t osrm) {
+  size_t results[OSRMC_ERROR_OVERLOADED + 1];
+  int before = failures;
+  int round;
+
+  /* One slot for 3 x 3 Tables: everyone queues, nobody waits until their deadline */
+  osrmc_osrm_set_admission(osrm, 1, 4, 64);
+  run_admission(osrm, 30000, results);
+  CHECK(results[OSRMC_OK] == THREADS * QUERIES);
+
+  /* Without a queue concurrent queries are turned away instead */
+  osrmc_osrm_set_admission(osrm, 1, 4, 0);
+  run_admission(osrm, 0, results);
+  CHECK(results[OSRMC_OK] + results[OSRMC_ERROR_OVERLOADED] == THREADS * QUERIES);
+  CHECK(results[OSRMC_OK] > 0);
+
+  /* Tight deadlines either make it or fail with DEADLINE_EXCEEDED */
+  osrmc_osrm_set_admission(osrm, 1, 4, 64);
+  run_admission(osrm, 1, results);
+  CHECK(results[OSRMC_OK] + results[OSRMC_ERROR_DEADLINE_EXCEEDED] == THREADS * QUERIES);
+
+  /* Cheap queries bypass admission control altogether */
+  osrmc_osrm_set_admission(osrm, 1, 100, 0);
+  run_admission(osrm, 0, results);
+  CHECK(results[OSRMC_OK] == THREADS * QUERIES);
+
+  for (round = 0; round < 5; ++round) {
+    test_admission_handoff(osrm);
+    test_admission_order(osrm);
+    test_admission_deadline(osrm);
+  }
+
+  osrmc_osrm_set_admission(osrm, 0, 0, 0);
+  report("admission", before);
+}
+
+
+/* Isochrones: closed rings for each threshold, bounded resolution */
+
+static void test_isochrone(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  osrmc_isochrone_params_t params;
+  osrmc_isochrone_response_t response;
+  const float* ring;
+  size_t threshold, rings, index, count;
+  int before = failures;
+
+  params = osrmc_isochrone_params_construct(longitudes[0], latitudes[0], &error);
+  if (!ok(&error))
+    return;
+
+  osrmc_isochrone_params_add_threshold(params, 60.f, &error);
+  osrmc_isochrone_params_add_threshold(params, 180.f, &error);
+  ok(&error);
+
+  osrmc_isochrone_params_set_resolution(params, 4097, 0, &error);
+  CHECK(status_of(&error) == OSRMC_ERROR_INVALID_VALUE);
+  osrmc_isochrone_params_set_resolution(params, 1024, 3, &error);
+  CHECK(status_of(&error) == OSRMC_ERROR_INVALID_VALUE);
+
+  osrmc_isochrone_params_set_resolution(params, 8, 2, &error);
+  ok(&error);
+  osrmc_isochrone_params_set_threads(params, 2);
+  osrmc_isochrone_params_set_deadline(params, 60000);
+
+  response = osrmc_isochrone(osrm, params, &error);
+  if (ok(&error)) {
+    CHECK(osrmc_isochrone_response_samples(response) > 0);
+    CHECK(osrmc_isochrone_response_rings(response, 1) > 0);
+
+    for (threshold = 0; threshold < 2; ++threshold) {
+      rings = osrmc_isochrone_response_rings(response, threshold);
+
+      for (index = 0; index < rings; ++index) {
+        ring = osrmc_isochrone_response_ring(response, threshold, index, &count);
+        CHECK(count >= 4);
+        CHECK(ring[0] == ring[2 * (count - 1)] && ring[1] == ring[2 * (count - 1) + 1]);
+      }
+    }
+
+    osrmc_isochrone_response_destruct(response);
+  }
+
+  osrmc_isochrone_params_destruct(params);
+  report("isochrone", before);
+}
+
+
+/* Warm-up report */
+
+static void test_warmup(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  osrmc_warmup_params_t params;
+  osrmc_startup_report_t startup;
+  size_t i;
+  int before = failures;
+
+  params = osrmc_warmup_params_construct(&error);
+  for (i = 0; i < COUNT; ++i)
+    osrmc_warmup_params_add_coordinate(params, longitudes[i], latitudes[i], &error);
+  osrmc_warmup_params_set_routes(params, 4);
+  osrmc_warmup_params_set_tables(params, 2, 3);
+  ok(&error);
+
+  startup = osrmc_warmup(osrm, params, &error);
+  if (ok(&error)) {
+    CHECK(osrmc_startup_report_load_seconds(startup) >= 0.f);
+    CHECK(osrmc_startup_report_first_query_seconds(startup) >= osrmc_startup_report_load_seconds(startup));
+    CHECK(osrmc_startup_report_query_seconds(startup, 50.f) <= osrmc_startup_report_query_seconds(startup, 100.f));
+
+    for (i = 0; i < osrmc_startup_report_files(startup); ++i)
+      CHECK(osrmc_startup_report_file_resident_bytes(startup, i) <= osrmc_startup_report_file_bytes(startup, i));
+
+    osrmc_startup_report_destruct(startup);
+  }
+
+  osrmc_warmup_params_destruct(params);
+  report("warmup", before);
+}
+
+
+/* Local query server: batched Routes, one of them invalid, and a Table over the socket */
+
+typedef struct {
+  osrmc_server_t server;
+  osrmc_error_t error;
+} server_job_t;
+
+static void* server_worker(void* data) {
+  server_job_t* job = (server_job_t*)data;
+  osrmc_server_run(job->server, &job->error);
+  return NULL;
+}
+
+typedef struct {
+  osrmc_osrm_t osrm;
+  size_t from;
+  size_t to;
+  int invalid;
+  osrmc_status_t status;
+  double duration;
+  size_t routes;
+  int done;
+} route_job_t;
+
+static void route_job_route(void* data, size_t route, double distance, double duration) {
+  (void)route;
+  (void)distance;
+  ((route_job_t*)data)->duration = duration;
+  ((route_job_t*)data)->routes += 1;
+}
+
+static void* route_worker(void* data) {
+  route_job_t* job = (route_job_t*)data;
+  osrmc_error_t error = NULL;
+  osrmc_route_params_t params;
+  osrmc_visitor_t visitor;
+
+  memset(&visitor, 0, sizeof(visitor));
+  visitor.route = route_job_route;
+
+  params = osrmc_route_params_construct(&error);
+  osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[job->from], latitudes[job->from], &error);
+  osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[job->to], job->invalid ? 91.f : latitudes[job->to],
+                              &error);
+
+  if (!error)
+    osrmc_route_visit(job->osrm, params, &visitor, job, &error);
+  job->status = status_of(&error);
+
+  osrmc_route_params_destruct(params);
+
+  pthread_mutex_lock(&progress);
+  job->done = 1;
+  pthread_mutex_unlock(&progress);
+  return NULL;
+}
+
+static int route_done(route_job_t* job) {
+  int done;
+
+  pthread_mutex_lock(&progress);
+  done = job->done;
+  pthread_mutex_unlock(&progress);
+  return done;
+}
+
+static void put_u32(unsigned char** out, uint32_t value) {
+  memcpy(*out, &value, sizeof(value));
+  *out += sizeof(value);
+}
+
+/* Connects without the library and sends Table requests for the first count coordinates of the slow lattice,
+ * without ever reading a response. Frames follow the wire format documented in osrmc.cc. */
+static int unread_client(const char* path, size_t requests, size_t count) {
+  struct sockaddr_un address;
+  unsigned char frame[64 + 8 * GRID * GRID];
+  unsigned char* out;
+  size_t request, i, length;
+  int fd;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  if (connect(fd, (const struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  for (request = 0; request < requests; ++request) {
+    out = frame + 3 * sizeof(uint32_t);
+
+    put_u32(&out, 0); /* no deadline */
+    put_u32(&out, 0); /* priority */
+    put_u32(&out, 1); /* durations */
+    put_u32(&out, (uint32_t)count);
+    put_u32(&out, 0); /* all sources */
+    put_u32(&out, 0); /* all destinations */
+
+    for (i = 0; i < count; ++i) {
+      put_u32(&out, (uint32_t)(int32_t)lroundf((7.410f + 0.025f * (i % GRID) / GRID) * 1e6f));
+      put_u32(&out, (uint32_t)(int32_t)lroundf((43.726f + 0.022f * (i / GRID) / GRID) * 1e6f));
+    }
+
+    length = (size_t)(out - frame);
+    out = frame;
+    put_u32(&out, (uint32_t)(length - 3 * sizeof(uint32_t)));
+    put_u32(&out, (uint32_t)request + 1);
+    put_u32(&out, 2); /* Table */
+
+    if (write(fd, frame, length) != (ssize_t)length) {
+      close(fd);
+      return -1;
+    }
+  }
+
+  return fd;
+}
+
+static void test_server(osrmc_osrm_t osrm) {
+  osrmc_error_t error = NULL;
+  char directory[] = "/tmp/osrmc-test-XXXXXX";
+  char path[64];
+  server_job_t server_job;
+  pthread_t server_thread;
+  osrmc_osrm_t remote;
+  osrmc_table_response_t exact, response;
+  osrmc_table_params_t params;
+  route_job_t jobs[THREADS];
+  pthread_t threads[THREADS];
+  float local[COUNT * COUNT], forwarded[COUNT * COUNT];
+  struct timespec pause = {0, 1000000};
+  size_t i;
+  int unread;
+  int before = failures;
+
+  if (!mkdtemp(directory)) {
+    CHECK(!"mkdtemp");
+    return;
+  }
+  snprintf(path, sizeof(path), "%s/socket", directory);
+
+  server_job.error = NULL;
+  server_job.server = osrmc_server_construct(osrm, path, 2, &error);
+  if (!ok(&error))
+    goto directory_cleanup;
+
+  /* A wide window so that the concurrent Routes below share a batch */
+  osrmc_server_set_batching(server_job.server, 64, 20000);
+  CHECK(pthread_create(&server_thread, NULL, server_worker, &server_job) == 0);
+
+  remote = osrmc_osrm_connect(path, &error);
+  if (!ok(&error))
+    goto server_cleanup;
+
+  exact = exact_table(osrm, all, COUNT);
+
+  /* The invalid query fails the batched Table; bisection confines the error to it */
+  memset(jobs, 0, sizeof(jobs));
+  for (i = 0; i < THREADS; ++i) {
+    jobs[i].osrm = remote;
+    jobs[i].from = i % COUNT;
+    jobs[i].to = (i + 1) % COUNT;
+    jobs[i].invalid = i == 0;
+    CHECK(pthread_create(&threads[i], NULL, route_worker, &jobs[i]) == 0);
+  }
+
+  for (i = 0; i < THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+
+    if (jobs[i].invalid) {
+      CHECK(jobs[i].status == OSRMC_ERROR_INVALID_VALUE);
+      continue;
+    }
+
+    CHECK(jobs[i].status == OSRMC_OK);
+    CHECK(jobs[i].routes == 1);
+    if (exact)
+      CHECK(near((float)jobs[i].duration, osrmc_table_response_duration(exact, jobs[i].from, jobs[i].to, NULL)));
+  }
+
+  /* Tables are forwarded as is */
+  params = osrmc_table_params_construct(&error);
+  osrmc_params_add_coordinates((osrmc_params_t)params, longitudes, latitudes, COUNT, &error);
+  if (ok(&error)) {
+    response = osrmc_table(remote, params, &error);
+    if (ok(&error)) {
+      osrmc_table_response_durations(response, forwarded, COUNT * COUNT, &error);
+      ok(&error);
+
+      if (exact) {
+        osrmc_table_response_durations(exact, local, COUNT * COUNT, &error);
+        ok(&error);
+        for (i = 0; i < COUNT * COUNT; ++i)
+          CHECK(near(forwarded[i], local[i]));
+      }
+
+      osrmc_table_response_destruct(response);
+    }
+  }
+  osrmc_table_params_destruct(params);
+
+  /* A client that stops reading must not hold up anybody else's responses */
+  unread = unread_client(path, 200, GRID * GRID / 2);
+  CHECK(unread >= 0);
+
+  memset(&jobs[0], 0, sizeof(jobs[0]));
+  jobs[0].osrm = remote;
+  jobs[0].to = 1;
+  CHECK(pthread_create(&threads[0], NULL, route_worker, &jobs[0]) == 0);
+
+  for (i = 0; i < 5000 && !route_done(&jobs[0]); ++i)
+    nanosleep(&pause, NULL);
+
+  if (!route_done(&jobs[0])) {
+    /* The route can not be cancelled, give up on the whole run */
+    fprintf(stderr, "FAIL %s:%d: server stalled by a client that does not read\n", __FILE__, __LINE__);
+    _exit(EXIT_FAILURE);
+  }
+
+  pthread_join(threads[0], NULL);
+  CHECK(jobs[0].status == OSRMC_OK);
+
+  if (unread >= 0)
+    close(unread);
+
+  osrmc_table_response_destruct(exact);
+  osrmc_osrm_destruct(remote);
+
+server_cleanup:
+  osrmc_server_stop(server_job.server);
+  pthread_join(server_thread, NULL);
+  ok(&server_job.error);
+  osrmc_server_destruct(server_job.server);
+directory_cleanup:
+  rmdir(directory);
+  report("server", before);
+}
+
+
+int main(int argc, char** argv) {
+  osrmc_error_t error = NULL;
+  osrmc_config_t config;
+  osrmc_osrm_t osrm;
+
+  if (!osrmc_is_abi_compatible()) {
+    fprintf(stderr, "Error: osrmc.h does not match the installed library\n");
+    return EXIT_FAILURE;
+  }
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s monaco.osrm\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  config = osrmc_config_construct(argv[1], &error);
+  if (!ok(&error))
+    return EXIT_FAILURE;
+
+  osrm = osrmc_osrm_construct(config, &error);
+  if (!ok(&error)) {
+    osrmc_config_destruct(config);
+    return EXIT_FAILURE;
+  }
+
+  test_table(osrm);
+  test_deduplicated(osrm);
+  test_matrix(osrm);
+  test_approx_table(osrm);
+  test_visitor(osrm);
+  test_admission(osrm);
+  test_isochrone(osrm);
+  test_warmup(osrm);
+  test_server(osrm);
+
+  osrmc_osrm_destruct(osrm);
+  osrmc_config_destruct(config);
+
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
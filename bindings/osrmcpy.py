@@ -185,9 +185,11 @@ class OSRM:
               alternatives=False, steps=False,
               annotations=False,
               geometries='polyline', overview='simplified',
-              continue_straight='default'):
+              continue_straight='default',
+              deadline=0, priority=0):
         # bearings is a list of tuples with (bearing, range)
         # radiuses is list of floats
+        # deadline is in milliseconds (0 for none), priority orders queued queries, higher first
         route = lib.osrmc_route(_.osrm, {
             'coordinates': [(coordinate.longitude, coordinate.latitude)
                             for coordinate in coordinates],
@@ -199,7 +201,9 @@ class OSRM:
             'annotations': annotations,
             'geometries': geometries,
             'overview': overview,
-            'continue_straight': continue_straight
+            'continue_straight': continue_straight,
+            'deadline': deadline,
+            'priority': priority
             }, c.byref(osrmc_error()))
         if not route:
             return
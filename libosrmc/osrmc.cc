@@ -1,10 +1,34 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <utility>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <stdexcept>
 #include <Python.h>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include <osrm/coordinate.hpp>
 #include <osrm/engine_config.hpp>
 #include <osrm/json_container.hpp>
@@ -39,26 +63,82 @@ int osrmc_is_abi_compatible(void) { return osrmc_get_version() >> 16u == OSRMC_V
 /* API */
 
 struct osrmc_error final {
+  osrmc_status_t status;
   std::string code;
   std::string message;
 };
 
+static thread_local osrmc_status_t osrmc_thread_status = OSRMC_OK;
+static thread_local char osrmc_thread_message[256];
+
+// Indexed by osrmc_status_t
+static const char* const osrmc_status_codes[] = {"Ok",           "Exception",    "Unknown",      "InvalidUrl",
+                                                 "InvalidService", "InvalidVersion", "InvalidOptions", "InvalidQuery",
+                                                 "InvalidValue", "NoSegment",    "TooBig",       "NoRoute",
+                                                 "NoTable",      "NoMatch",      "NoTrips",      "NotImplemented",
+                                                 "DeadlineExceeded", "Overloaded"};
+
+static osrmc_status_t osrmc_status_from_code(const std::string& code) {
+  const auto count = sizeof(osrmc_status_codes) / sizeof(osrmc_status_codes[0]);
+
+  for (std::size_t i = 0; i < count; ++i)
+    if (code == osrmc_status_codes[i])
+      return static_cast<osrmc_status_t>(i);
+
+  return OSRMC_ERROR_UNKNOWN;
+}
+
+// Records the failure in the thread-local channel; allocates an error object only if the caller asked for one.
+static void osrmc_error_set(osrmc_status_t status, const char* code, const char* message, osrmc_error_t* error) {
+  const auto length = std::min(std::strlen(message), sizeof(osrmc_thread_message) - 1);
+  std::memcpy(osrmc_thread_message, message, length);
+  osrmc_thread_message[length] = '\0';
+  osrmc_thread_status = status;
+
+  if (error)
+    *error = new osrmc_error{status, code, message};
+}
+
+static void osrmc_error_set(osrmc_status_t status, const char* message, osrmc_error_t* error) {
+  osrmc_error_set(status, osrmc_status_code(status), message, error);
+}
+
 static void osrmc_error_from_exception(const std::exception& e, osrmc_error_t* error) {
-  *error = new osrmc_error{"Exception", e.what()};
+  osrmc_error_set(OSRMC_ERROR_EXCEPTION, e.what(), error);
 }
 
 static void osrmc_error_from_json(osrm::json::Object& json, osrmc_error_t* error) try {
-  auto code = json.values["code"].get<osrm::json::String>().value;
-  auto message = json.values["message"].get<osrm::json::String>().value;
-  if (code.empty()) {
-    code = "Unknown";
-  }
+  const auto& code = json.values["code"].get<osrm::json::String>().value;
+  const auto& message = json.values["message"].get<osrm::json::String>().value;
 
-  *error = new osrmc_error{code, message};
+  if (code.empty())
+    osrmc_error_set(OSRMC_ERROR_UNKNOWN, message.c_str(), error);
+  else
+    osrmc_error_set(osrmc_status_from_code(code), code.c_str(), message.c_str(), error);
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
 }
 
+osrmc_status_t osrmc_last_status(void) { return osrmc_thread_status; }
+
+const char* osrmc_last_message(void) { return osrmc_thread_message; }
+
+void osrmc_clear_status(void) {
+  osrmc_thread_status = OSRMC_OK;
+  osrmc_thread_message[0] = '\0';
+}
+
+const char* osrmc_status_code(osrmc_status_t status) {
+  const auto count = sizeof(osrmc_status_codes) / sizeof(osrmc_status_codes[0]);
+
+  if (static_cast<std::size_t>(status) >= count)
+    return "Unknown";
+
+  return osrmc_status_codes[status];
+}
+
+osrmc_status_t osrmc_error_status(osrmc_error_t error) { return error->status; }
+
 const char* osrmc_error_code(osrmc_error_t error) { return error->code.c_str(); }
 
 const char* osrmc_error_message(osrmc_error_t error) { return error->message.c_str(); }
@@ -86,17 +166,124 @@ osrmc_config_t osrmc_config_construct(const char* base_path, osrmc_error_t* erro
 
 void osrmc_config_destruct(osrmc_config_t config) { delete reinterpret_cast<osrm::EngineConfig*>(config); }
 
+struct osrmc_client;
+
+// Scheduling options of one query: an absolute deadline (none by default) and a priority, higher first.
+struct osrmc_request final {
+  osrmc_request() = default;
+  osrmc_request(unsigned deadline_ms, int priority_) : priority{priority_} {
+    if (deadline_ms > 0)
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{deadline_ms};
+  }
+
+  bool HasDeadline() const { return deadline != std::chrono::steady_clock::time_point{}; }
+
+  std::chrono::steady_clock::time_point deadline{};
+  int priority = 0;
+};
+
+// Service parameters behind the osrmc_*_params_t handles; the deadline starts when a query is issued.
+template <typename Parameters>
+struct osrmc_query_params : Parameters {
+  unsigned deadline = 0; // milliseconds, zero means none
+  int priority = 0;
+
+  osrmc_request Request() const { return {deadline, priority}; }
+};
+
+struct osrmc_route_params final : osrmc_query_params<osrm::RouteParameters> {};
+struct osrmc_table_params final : osrmc_query_params<osrm::TableParameters> {};
+struct osrmc_nearest_params final : osrmc_query_params<osrm::NearestParameters> {};
+struct osrmc_match_params final : osrmc_query_params<osrm::MatchParameters> {};
+
+enum osrmc_service : std::size_t {
+  OSRMC_SERVICE_ROUTE,
+  OSRMC_SERVICE_TABLE,
+  OSRMC_SERVICE_NEAREST,
+  OSRMC_SERVICE_MATCH
+};
+
+// Limits concurrently running expensive queries per handle; cheap queries are never queued.
+struct osrmc_admission final {
+  struct Waiter {
+    int priority;
+    std::uint64_t ticket;
+    double seconds;
+  };
+
+  std::atomic<unsigned> max_expensive{0}; // zero disables admission control
+  std::atomic<double> expensive_cost{10000.};
+  std::size_t max_queue = 1024;
+
+  std::mutex mutex;
+  std::condition_variable released;
+
+  unsigned running = 0;
+  double running_seconds = 0.;
+  std::uint64_t next_ticket = 0;
+  std::vector<Waiter> queue;
+
+  // Learned seconds per cost unit, indexed by osrmc_service
+  double seconds_per_cost[4] = {1e-3, 5e-6, 1e-4, 2e-3};
+};
+
+// Either owns the engine for a local dataset or forwards queries to an osrmc_server over its socket.
+struct osrmc_osrm final {
+  osrmc_osrm();
+  ~osrmc_osrm();
+
+  osrm::Status Route(const osrm::RouteParameters& params, osrm::json::Object& result,
+                     const osrmc_request& request = osrmc_request{});
+  osrm::Status Table(const osrm::TableParameters& params, osrm::json::Object& result,
+                     const osrmc_request& request = osrmc_request{});
+  osrm::Status Nearest(const osrm::NearestParameters& params, osrm::json::Object& result,
+                       const osrmc_request& request = osrmc_request{});
+  osrm::Status Match(const osrm::MatchParameters& params, osrm::json::Object& result,
+                     const osrmc_request& request = osrmc_request{});
+
+  std::unique_ptr<osrm::OSRM> engine;
+  std::unique_ptr<osrmc_client> client;
+
+  osrmc_admission admission;
+
+  std::string base_path;
+  std::chrono::steady_clock::time_point constructed;
+  float load_seconds = 0.f;
+
+  // Seconds from the start of construction until the first engine query completed, NAN until then
+  std::atomic<bool> served{false};
+  std::atomic<float> first_query_seconds{NAN};
+
+  void Served() {
+    if (served.load(std::memory_order_relaxed) || served.exchange(true))
+      return;
+
+    const auto elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - constructed).count();
+    first_query_seconds.store(load_seconds + elapsed);
+  }
+};
+
 osrmc_osrm_t osrmc_osrm_construct(osrmc_config_t config, osrmc_error_t* error) try {
   auto* config_typed = reinterpret_cast<osrm::EngineConfig*>(config);
-  auto* out = new osrm::OSRM(*config_typed);
 
-  return reinterpret_cast<osrmc_osrm_t>(out);
+  std::unique_ptr<osrmc_osrm> out{new osrmc_osrm};
+
+  const auto start = std::chrono::steady_clock::now();
+  out->engine.reset(new osrm::OSRM(*config_typed));
+
+  out->constructed = std::chrono::steady_clock::now();
+  out->load_seconds = std::chrono::duration<float>(out->constructed - start).count();
+
+  if (!config_typed->use_shared_memory)
+    out->base_path = config_typed->storage_config.base_path.string();
+
+  return out.release();
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_osrm_destruct(osrmc_osrm_t osrm) { delete reinterpret_cast<osrm::OSRM*>(osrm); }
+void osrmc_osrm_destruct(osrmc_osrm_t osrm) { delete osrm; }
 
 void osrmc_base_params_update(osrm::engine::api::BaseParameters *params, PyObject *in) {
     PyObject *coordinates = PyDict_GetItemString(in, "coordinates");
@@ -195,6 +382,18 @@ void osrmc_route_params_update(osrm::engine::api::RouteParameters *params, PyObj
     }
 }
 
+osrmc_request osrmc_request_from_dict(PyObject *in) {
+    unsigned deadline = 0;
+    int priority = 0;
+    if (PyDict_Contains(in, PY_FROM_STR("deadline")) == 1) {
+        deadline = static_cast<unsigned>(PyLong_AsUnsignedLong(PyDict_GetItemString(in, "deadline")));
+    }
+    if (PyDict_Contains(in, PY_FROM_STR("priority")) == 1) {
+        priority = static_cast<int>(PyLong_AsLong(PyDict_GetItemString(in, "priority")));
+    }
+    return osrmc_request{deadline, priority};
+}
+
 void osrmc_params_add_coordinate(osrmc_params_t params, float longitude, float latitude, osrmc_error_t* error) try {
   auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
 
@@ -222,19 +421,34 @@ void osrmc_params_add_coordinate_with(osrmc_params_t params, float longitude, fl
   osrmc_error_from_exception(e, error);
 }
 
-osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::RouteParameters;
+void osrmc_params_add_coordinates(osrmc_params_t params, const float* longitudes, const float* latitudes, size_t count,
+                                  osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+
+  params_typed->coordinates.reserve(params_typed->coordinates.size() + count);
+
+  for (size_t i = 0; i < count; ++i)
+    params_typed->coordinates.emplace_back(osrm::util::FloatLongitude{longitudes[i]},
+                                           osrm::util::FloatLatitude{latitudes[i]});
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
 
-  return reinterpret_cast<osrmc_route_params_t>(out);
+osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error) try {
+  return new osrmc_route_params;
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_route_params_destruct(osrmc_route_params_t params) {
-  delete reinterpret_cast<osrm::RouteParameters*>(params);
+void osrmc_route_params_destruct(osrmc_route_params_t params) { delete params; }
+
+void osrmc_route_params_set_deadline(osrmc_route_params_t params, unsigned milliseconds) {
+  params->deadline = milliseconds;
 }
 
+void osrmc_route_params_set_priority(osrmc_route_params_t params, int priority) { params->priority = priority; }
+
 void osrmc_route_params_add_steps(osrmc_route_params_t params, int on) {
   auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
   params_typed->steps = on;
@@ -249,17 +463,18 @@ osrmc_route_response_t osrmc_route(osrmc_osrm_t osrm, osrmc_route_params_t param
   auto* out = new osrm::json::Object;
   auto* params_cpp = new osrm::RouteParameters;
   try {
-    auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
     auto* params_input = reinterpret_cast<PyObject *>(params);
 
     osrmc_route_params_update(params_cpp, params_input);
-    const auto status = osrm_typed->Route(*params_cpp, *out);
+    const auto status = osrm->Route(*params_cpp, *out, osrmc_request_from_dict(params_input));
     delete params_cpp;
+    params_cpp = nullptr;
     if (status == osrm::Status::Ok) {
         return reinterpret_cast<osrmc_route_response_t>(out);
     }
 
     osrmc_error_from_json(*out, error);
+    delete out;
     return nullptr;
   } catch (const std::exception& e) {
     delete out;
@@ -271,11 +486,10 @@ osrmc_route_response_t osrmc_route(osrmc_osrm_t osrm, osrmc_route_params_t param
 
 void osrmc_route_with(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_waypoint_handler_t handler, void* data,
                       osrmc_error_t* error) try {
-  auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
   auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
 
   osrm::json::Object result;
-  const auto status = osrm_typed->Route(*params_typed, result);
+  const auto status = osrm->Route(*params_typed, result, params->Request());
 
   if (status != osrm::Status::Ok) {
     osrmc_error_from_json(result, error);
@@ -354,17 +568,20 @@ void osrmc_table_annotations_enable_distance(osrmc_table_annotations_t annotatio
 }
 
 osrmc_table_params_t osrmc_table_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::TableParameters;
-  return reinterpret_cast<osrmc_table_params_t>(out);
+  return new osrmc_table_params;
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_table_params_destruct(osrmc_table_params_t params) {
-  delete reinterpret_cast<osrm::TableParameters*>(params);
+void osrmc_table_params_destruct(osrmc_table_params_t params) { delete params; }
+
+void osrmc_table_params_set_deadline(osrmc_table_params_t params, unsigned milliseconds) {
+  params->deadline = milliseconds;
 }
 
+void osrmc_table_params_set_priority(osrmc_table_params_t params, int priority) { params->priority = priority; }
+
 void osrmc_table_params_add_source(osrmc_table_params_t params, size_t index, osrmc_error_t* error) try {
   auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
   params_typed->sources.emplace_back(index);
@@ -388,14 +605,13 @@ void osrmc_table_params_set_annotations(osrmc_table_params_t params, osrmc_table
 }
 
 osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_error_t* error) try {
-  auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
   auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
 
-  auto* out = new osrm::json::Object;
-  const auto status = osrm_typed->Table(*params_typed, *out);
+  std::unique_ptr<osrm::json::Object> out{new osrm::json::Object};
+  const auto status = osrm->Table(*params_typed, *out, params->Request());
 
   if (status == osrm::Status::Ok)
-    return reinterpret_cast<osrmc_table_response_t>(out);
+    return reinterpret_cast<osrmc_table_response_t>(out.release());
 
   osrmc_error_from_json(*out, error);
   return nullptr;
@@ -404,6 +620,259 @@ osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t param
   return nullptr;
 }
 
+/* Coordinate deduplication */
+
+static double osrmc_haversine(double from_longitude, double from_latitude, double to_longitude, double to_latitude) {
+  const double earth_radius = 6372797.560856;
+  const double to_radians = M_PI / 180.;
+
+  const auto dlat = (to_latitude - from_latitude) * to_radians;
+  const auto dlon = (to_longitude - from_longitude) * to_radians;
+  const auto a = std::sin(dlat / 2.) * std::sin(dlat / 2.) + std::cos(from_latitude * to_radians) *
+                                                                  std::cos(to_latitude * to_radians) *
+                                                                  std::sin(dlon / 2.) * std::sin(dlon / 2.);
+  return 2. * earth_radius * std::asin(std::min(1., std::sqrt(a)));
+}
+
+struct osrmc_cell_hash final {
+  std::size_t operator()(const std::pair<std::int64_t, std::int64_t>& cell) const {
+    return std::hash<std::int64_t>()(cell.first) * 31 + std::hash<std::int64_t>()(cell.second);
+  }
+};
+
+// Greedily groups coordinates within tolerance meters of a group's first coordinate.
+// Returns the group index per coordinate; representatives receives each group's first coordinate index.
+static std::vector<std::size_t> osrmc_cluster(const std::vector<osrm::util::Coordinate>& coordinates, double tolerance,
+                                              std::vector<std::size_t>& representatives) {
+  using Cell = std::pair<std::int64_t, std::int64_t>;
+
+  std::vector<std::size_t> groups(coordinates.size());
+  representatives.clear();
+
+  const auto longitude = [&](std::size_t i) { return static_cast<double>(osrm::util::toFloating(coordinates[i].lon)); };
+  const auto latitude = [&](std::size_t i) { return static_cast<double>(osrm::util::toFloating(coordinates[i].lat)); };
+
+  // Exact matches: fixed-point coordinates are directly comparable
+  if (tolerance <= 0) {
+    std::unordered_map<Cell, std::size_t, osrmc_cell_hash> seen;
+    for (std::size_t i = 0; i < coordinates.size(); ++i) {
+      const auto inserted = seen.emplace(Cell{static_cast<std::int32_t>(coordinates[i].lon),
+                                              static_cast<std::int32_t>(coordinates[i].lat)},
+                                         representatives.size());
+      if (inserted.second)
+        representatives.emplace_back(i);
+      groups[i] = inserted.first->second;
+    }
+    return groups;
+  }
+
+  // Cells are at least tolerance meters wide everywhere in the set, so neighbours are within one cell
+  double max_latitude = 0.;
+  for (std::size_t i = 0; i < coordinates.size(); ++i)
+    max_latitude = std::max(max_latitude, std::abs(latitude(i)));
+
+  const double meters_per_degree = 111319.49;
+  const auto latitude_cell = tolerance / meters_per_degree;
+  const auto longitude_cell = tolerance / (meters_per_degree * std::max(0.01, std::cos(max_latitude * M_PI / 180.)));
+
+  std::unordered_map<Cell, std::vector<std::size_t>, osrmc_cell_hash> grid;
+
+  for (std::size_t i = 0; i < coordinates.size(); ++i) {
+    const auto x = static_cast<std::int64_t>(std::floor(longitude(i) / longitude_cell));
+    const auto y = static_cast<std::int64_t>(std::floor(latitude(i) / latitude_cell));
+
+    auto group = representatives.size();
+
+    for (auto dx = -1; dx <= 1 && group == representatives.size(); ++dx) {
+      for (auto dy = -1; dy <= 1 && group == representatives.size(); ++dy) {
+        const auto cell = grid.find(Cell{x + dx, y + dy});
+        if (cell == grid.end())
+          continue;
+
+        for (const auto candidate : cell->second) {
+          const auto representative = representatives[candidate];
+          if (osrmc_haversine(longitude(i), latitude(i), longitude(representative), latitude(representative)) <=
+              tolerance) {
+            group = candidate;
+            break;
+          }
+        }
+      }
+    }
+
+    if (group == representatives.size()) {
+      representatives.emplace_back(i);
+      grid[Cell{x, y}].emplace_back(group);
+    }
+
+    groups[i] = group;
+  }
+
+  return groups;
+}
+
+static std::vector<osrm::util::Coordinate> osrmc_snap(osrmc_osrm& osrm, const osrm::TableParameters& params,
+                                                      const osrmc_request& request) {
+  std::vector<osrm::util::Coordinate> snapped;
+  snapped.reserve(params.coordinates.size());
+
+  osrm::NearestParameters nearest;
+  nearest.number_of_results = 1;
+  nearest.coordinates.resize(1);
+
+  for (std::size_t i = 0; i < params.coordinates.size(); ++i) {
+    nearest.coordinates[0] = params.coordinates[i];
+    nearest.radiuses.clear();
+    nearest.bearings.clear();
+    if (i < params.radiuses.size())
+      nearest.radiuses.emplace_back(params.radiuses[i]);
+    if (i < params.bearings.size())
+      nearest.bearings.emplace_back(params.bearings[i]);
+
+    osrm::json::Object result;
+
+    // Coordinates the engine can not snap keep their original location
+    if (osrm.Nearest(nearest, result, request) != osrm::Status::Ok) {
+      snapped.emplace_back(params.coordinates[i]);
+      continue;
+    }
+
+    const auto& waypoints = result.values.at("waypoints").get<osrm::json::Array>().values;
+    const auto& waypoint = waypoints.at(0).get<osrm::json::Object>();
+    const auto& location = waypoint.values.at("location").get<osrm::json::Array>().values;
+
+    snapped.emplace_back(osrm::util::FloatLongitude{location.at(0).get<osrm::json::Number>().value},
+                         osrm::util::FloatLatitude{location.at(1).get<osrm::json::Number>().value});
+  }
+
+  return snapped;
+}
+
+// Maps original source or destination indices onto the reduced coordinate set.
+// Returns for each original entry its position in reduced, which receives the distinct reduced indices.
+static std::vector<std::size_t> osrmc_reduce_indices(const std::vector<std::size_t>& indices, std::size_t count,
+                                                     const std::vector<std::size_t>& groups,
+                                                     std::vector<std::size_t>& reduced) {
+  std::vector<std::size_t> positions;
+  std::unordered_map<std::size_t, std::size_t> seen;
+
+  const auto all = indices.empty();
+  const auto size = all ? count : indices.size();
+  positions.reserve(size);
+
+  for (std::size_t i = 0; i < size; ++i) {
+    const auto group = groups.at(all ? i : indices[i]);
+    const auto inserted = seen.emplace(group, reduced.size());
+    if (inserted.second)
+      reduced.emplace_back(group);
+    positions.emplace_back(inserted.first->second);
+  }
+
+  return positions;
+}
+
+static void osrmc_expand_table(osrm::json::Object& reduced, osrm::json::Object& out, const char* key,
+                               const std::vector<std::size_t>& rows, const std::vector<std::size_t>& columns) {
+  const auto found = reduced.values.find(key);
+  if (found == reduced.values.end())
+    return;
+
+  const auto& table = found->second.get<osrm::json::Array>().values;
+
+  osrm::json::Array expanded;
+  expanded.values.reserve(rows.size());
+
+  for (const auto row : rows) {
+    const auto& cells = table.at(row).get<osrm::json::Array>().values;
+
+    osrm::json::Array expanded_row;
+    expanded_row.values.reserve(columns.size());
+    for (const auto column : columns)
+      expanded_row.values.emplace_back(cells.at(column));
+
+    expanded.values.emplace_back(std::move(expanded_row));
+  }
+
+  out.values[key] = std::move(expanded);
+}
+
+static void osrmc_expand_waypoints(osrm::json::Object& reduced, osrm::json::Object& out, const char* key,
+                                   const std::vector<std::size_t>& positions) {
+  const auto found = reduced.values.find(key);
+  if (found == reduced.values.end())
+    return;
+
+  const auto& waypoints = found->second.get<osrm::json::Array>().values;
+
+  osrm::json::Array expanded;
+  expanded.values.reserve(positions.size());
+  for (const auto position : positions)
+    expanded.values.emplace_back(waypoints.at(position));
+
+  out.values[key] = std::move(expanded);
+}
+
+osrmc_table_response_t osrmc_table_deduplicated(osrmc_osrm_t osrm, osrmc_table_params_t params, float tolerance,
+                                                int snap, size_t* unique, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+
+  const auto count = params_typed->coordinates.size();
+  const auto request = params->Request();
+
+  std::vector<std::size_t> representatives;
+  const auto groups = snap ? osrmc_cluster(osrmc_snap(*osrm, *params_typed, request), tolerance, representatives)
+                           : osrmc_cluster(params_typed->coordinates, tolerance, representatives);
+
+  // Keeps every option (exclude, fallback speed, scale factor, ...); only per-coordinate data is reduced
+  osrm::TableParameters reduced_params{*params_typed};
+  reduced_params.coordinates.clear();
+  reduced_params.radiuses.clear();
+  reduced_params.bearings.clear();
+  reduced_params.hints.clear();
+  reduced_params.approaches.clear();
+  reduced_params.sources.clear();
+  reduced_params.destinations.clear();
+
+  for (const auto representative : representatives) {
+    reduced_params.coordinates.emplace_back(params_typed->coordinates[representative]);
+    if (representative < params_typed->radiuses.size())
+      reduced_params.radiuses.emplace_back(params_typed->radiuses[representative]);
+    if (representative < params_typed->bearings.size())
+      reduced_params.bearings.emplace_back(params_typed->bearings[representative]);
+    if (representative < params_typed->hints.size())
+      reduced_params.hints.emplace_back(params_typed->hints[representative]);
+    if (representative < params_typed->approaches.size())
+      reduced_params.approaches.emplace_back(params_typed->approaches[representative]);
+  }
+
+  const auto rows = osrmc_reduce_indices(params_typed->sources, count, groups, reduced_params.sources);
+  const auto columns = osrmc_reduce_indices(params_typed->destinations, count, groups, reduced_params.destinations);
+
+  if (unique)
+    *unique = representatives.size();
+
+  osrm::json::Object reduced;
+  const auto status = osrm->Table(reduced_params, reduced, request);
+
+  if (status != osrm::Status::Ok) {
+    osrmc_error_from_json(reduced, error);
+    return nullptr;
+  }
+
+  std::unique_ptr<osrm::json::Object> out{new osrm::json::Object};
+  out->values["code"] = reduced.values["code"];
+
+  osrmc_expand_table(reduced, *out, "durations", rows, columns);
+  osrmc_expand_table(reduced, *out, "distances", rows, columns);
+  osrmc_expand_waypoints(reduced, *out, "sources", rows);
+  osrmc_expand_waypoints(reduced, *out, "destinations", columns);
+
+  return reinterpret_cast<osrmc_table_response_t>(out.release());
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
 void osrmc_table_response_destruct(osrmc_table_response_t response) {
   delete reinterpret_cast<osrm::json::Object*>(response);
 }
@@ -413,16 +882,16 @@ float osrmc_table_response_duration(osrmc_table_response_t response, unsigned lo
   auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
 
   if (response_typed->values.find("durations") == response_typed->values.end()) {
-    *error = new osrmc_error{"NoTable", "Table request not configured to return durations"};
+    osrmc_error_set(OSRMC_ERROR_NO_TABLE, "Table request not configured to return durations", error);
     return INFINITY;
   }
 
   auto& durations = response_typed->values["durations"].get<osrm::json::Array>();
   auto& durations_from_to_all = durations.values.at(from).get<osrm::json::Array>();
-  auto nullable = durations_from_to_all.values.at(to);
+  const auto& nullable = durations_from_to_all.values.at(to);
 
   if (nullable.is<osrm::json::Null>()) {
-    *error = new osrmc_error{"NoRoute", "Impossible route between points"};
+    osrmc_error_set(OSRMC_ERROR_NO_ROUTE, "Impossible route between points", error);
     return INFINITY;
   }
   auto duration = nullable.get<osrm::json::Number>().value;
@@ -438,62 +907,2789 @@ float osrmc_table_response_distance(osrmc_table_response_t response, unsigned lo
   auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
 
   if (response_typed->values.find("distances") == response_typed->values.end()) {
-    *error = new osrmc_error{"NoTable", "Table request not configured to return distances"};
+    osrmc_error_set(OSRMC_ERROR_NO_TABLE, "Table request not configured to return distances", error);
     return INFINITY;
   }
 
   auto& distances = response_typed->values["distances"].get<osrm::json::Array>();
   auto& distances_from_to_all = distances.values.at(from).get<osrm::json::Array>();
-  auto nullable = distances_from_to_all.values.at(to);
+  const auto& nullable = distances_from_to_all.values.at(to);
 
   if (nullable.is<osrm::json::Null>()) {
-    *error = new osrmc_error{"NoRoute", "Impossible route between points"};
+    osrmc_error_set(OSRMC_ERROR_NO_ROUTE, "Impossible route between points", error);
     return INFINITY;
   }
   auto distance = nullable.get<osrm::json::Number>().value;
 
   return distance;
 } catch (const std::exception& e) {
-  *error = new osrmc_error{e.what()};
+  osrmc_error_from_exception(e, error);
   return INFINITY;
 }
 
-osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::NearestParameters;
-  return reinterpret_cast<osrmc_nearest_params_t>(out);
+// Either table works for the shape; a response carries durations, distances or both.
+static const osrm::json::Array& osrmc_table_response_cells(const osrm::json::Object& response) {
+  auto it = response.values.find("durations");
+  if (it == response.values.end())
+    it = response.values.find("distances");
+  if (it == response.values.end())
+    throw std::runtime_error("Table response contains neither durations nor distances");
+
+  return it->second.get<osrm::json::Array>();
+}
+
+size_t osrmc_table_response_rows(osrmc_table_response_t response, osrmc_error_t* error) try {
+  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+
+  return osrmc_table_response_cells(*response_typed).values.size();
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return nullptr;
+  return 0;
 }
 
-void osrmc_nearest_params_destruct(osrmc_nearest_params_t params) {
-  delete reinterpret_cast<osrm::NearestParameters*>(params);
+size_t osrmc_table_response_columns(osrmc_table_response_t response, osrmc_error_t* error) try {
+  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+  const auto& rows = osrmc_table_response_cells(*response_typed).values;
+
+  return rows.empty() ? 0 : rows.front().get<osrm::json::Array>().values.size();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return 0;
 }
 
-osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::MatchParameters;
-  return reinterpret_cast<osrmc_match_params_t>(out);
+static void osrmc_table_response_copy(const osrm::json::Object& response, const char* key, float* out,
+                                      std::size_t capacity, osrmc_error_t* error) {
+  const auto& rows = response.values.at(key).get<osrm::json::Array>().values;
+
+  std::size_t cells = 0;
+  for (const auto& row : rows)
+    cells += row.get<osrm::json::Array>().values.size();
+
+  if (cells > capacity) {
+    osrmc_error_set(OSRMC_ERROR_INVALID_VALUE, "Output buffer holds fewer floats than the table has cells", error);
+    return;
+  }
+
+  for (const auto& row : rows) {
+    for (const auto& nullable : row.get<osrm::json::Array>().values) {
+      if (nullable.is<osrm::json::Null>())
+        *out++ = INFINITY;
+      else
+        *out++ = nullable.get<osrm::json::Number>().value;
+    }
+  }
+}
+
+void osrmc_table_response_durations(osrmc_table_response_t response, float* out, size_t capacity,
+                                    osrmc_error_t* error) try {
+  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+
+  if (response_typed->values.find("durations") == response_typed->values.end()) {
+    osrmc_error_set(OSRMC_ERROR_NO_TABLE, "Table request not configured to return durations", error);
+    return;
+  }
+
+  osrmc_table_response_copy(*response_typed, "durations", out, capacity, error);
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return nullptr;
 }
 
-void osrmc_match_params_destruct(osrmc_match_params_t params) {
-  delete reinterpret_cast<osrm::MatchParameters*>(params);
+void osrmc_table_response_distances(osrmc_table_response_t response, float* out, size_t capacity,
+                                    osrmc_error_t* error) try {
+  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+
+  if (response_typed->values.find("distances") == response_typed->values.end()) {
+    osrmc_error_set(OSRMC_ERROR_NO_TABLE, "Table request not configured to return distances", error);
+    return;
+  }
+
+  osrmc_table_response_copy(*response_typed, "distances", out, capacity, error);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
 }
 
-void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n) {
-  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
-  params_typed->number_of_results = n;
+/* Incremental matrix */
+
+struct osrmc_matrix final {
+  osrmc_osrm* osrm;
+  osrm::TableParameters::AnnotationsType annotations;
+  std::vector<osrm::util::Coordinate> coordinates;
+  std::vector<float> durations;
+  std::vector<float> distances;
+};
+
+static bool osrmc_table_annotations_has(osrm::TableParameters::AnnotationsType annotations,
+                                        osrm::TableParameters::AnnotationsType annotation) {
+  return (static_cast<int>(annotations) & static_cast<int>(annotation)) != 0;
 }
 
-void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
-  params_typed->timestamps.emplace_back(timestamp);
+// Extracts a rows x columns block from a Table response, unreachable cells become INFINITY.
+static std::vector<float> osrmc_table_extract(osrm::json::Object& response, const char* key, std::size_t rows,
+                                              std::size_t columns) {
+  const auto& table = response.values.at(key).get<osrm::json::Array>().values;
+  if (table.size() != rows)
+    throw std::runtime_error("Unexpected number of rows in Table response");
+
+  std::vector<float> out;
+  out.reserve(rows * columns);
+
+  for (const auto& row : table) {
+    const auto& cells = row.get<osrm::json::Array>().values;
+    if (cells.size() != columns)
+      throw std::runtime_error("Unexpected number of columns in Table response");
+
+    for (const auto& nullable : cells) {
+      if (nullable.is<osrm::json::Null>())
+        out.push_back(INFINITY);
+      else
+        out.push_back(nullable.get<osrm::json::Number>().value);
+    }
+  }
+
+  return out;
+}
+
+// Re-lays out a size x size row-major buffer as (size + count) x (size + count) in place.
+static void osrmc_matrix_grow(std::vector<float>& cells, std::size_t size, std::size_t count) {
+  const auto grown = size + count;
+  cells.resize(grown * grown, INFINITY);
+
+  for (std::size_t row = size; row-- > 0;) {
+    const auto first = cells.begin() + row * size;
+    std::copy_backward(first, first + size, cells.begin() + row * grown + size);
+  }
+}
+
+// Keeps only the rows and columns listed in kept (ascending) of a size x size row-major buffer in place.
+static void osrmc_matrix_compact(std::vector<float>& cells, std::size_t size, const std::vector<std::size_t>& kept) {
+  const auto shrunk = kept.size();
+
+  for (std::size_t row = 0; row < shrunk; ++row)
+    for (std::size_t column = 0; column < shrunk; ++column)
+      cells[row * shrunk + column] = cells[kept[row] * size + kept[column]];
+
+  cells.resize(shrunk * shrunk);
+}
+
+static void osrmc_matrix_paste(std::vector<float>& cells, std::size_t stride, std::size_t first_row,
+                               std::size_t first_column, std::size_t columns, const std::vector<float>& block) {
+  for (std::size_t offset = 0; offset < block.size(); offset += columns) {
+    const auto row = first_row + offset / columns;
+    std::copy(block.begin() + offset, block.begin() + offset + columns, cells.begin() + row * stride + first_column);
+  }
+}
+
+osrmc_matrix_t osrmc_matrix_construct(osrmc_osrm_t osrm, osrmc_table_annotations_t annotations,
+                                      osrmc_error_t* error) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  auto* annotations_typed = reinterpret_cast<AnnotationsType*>(annotations);
+
+  auto* out = new osrmc_matrix{osrm, annotations_typed ? *annotations_typed : AnnotationsType::Duration, {}, {}, {}};
+  return out;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_matrix_destruct(osrmc_matrix_t matrix) { delete matrix; }
+
+void osrmc_matrix_add_coordinates(osrmc_matrix_t matrix, const float* longitudes, const float* latitudes, size_t count,
+                                  osrmc_error_t* error) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  if (count == 0)
+    return;
+
+  const auto size = matrix->coordinates.size();
+  const auto grown = size + count;
+
+  osrm::TableParameters params;
+  params.annotations = matrix->annotations;
+  params.coordinates.reserve(grown);
+  params.coordinates = matrix->coordinates;
+
+  for (std::size_t i = 0; i < count; ++i)
+    params.coordinates.emplace_back(osrm::util::FloatLongitude{longitudes[i]}, osrm::util::FloatLatitude{latitudes[i]});
+
+  // New rows: new coordinates against all coordinates
+  for (std::size_t i = size; i < grown; ++i)
+    params.sources.emplace_back(i);
+
+  osrm::json::Object rows;
+  if (matrix->osrm->Table(params, rows) != osrm::Status::Ok) {
+    osrmc_error_from_json(rows, error);
+    return;
+  }
+
+  // New columns: existing coordinates against new coordinates
+  osrm::json::Object columns;
+  if (size > 0) {
+    params.sources.clear();
+    for (std::size_t i = 0; i < size; ++i)
+      params.sources.emplace_back(i);
+    for (std::size_t i = size; i < grown; ++i)
+      params.destinations.emplace_back(i);
+
+    if (matrix->osrm->Table(params, columns) != osrm::Status::Ok) {
+      osrmc_error_from_json(columns, error);
+      return;
+    }
+  }
+
+  const auto with_durations = osrmc_table_annotations_has(matrix->annotations, AnnotationsType::Duration);
+  const auto with_distances = osrmc_table_annotations_has(matrix->annotations, AnnotationsType::Distance);
+
+  std::vector<float> duration_rows, duration_columns, distance_rows, distance_columns;
+
+  if (with_durations) {
+    duration_rows = osrmc_table_extract(rows, "durations", count, grown);
+    if (size > 0)
+      duration_columns = osrmc_table_extract(columns, "durations", size, count);
+    matrix->durations.reserve(grown * grown);
+  }
+
+  if (with_distances) {
+    distance_rows = osrmc_table_extract(rows, "distances", count, grown);
+    if (size > 0)
+      distance_columns = osrmc_table_extract(columns, "distances", size, count);
+    matrix->distances.reserve(grown * grown);
+  }
+
+  // Everything below only touches reserved memory and can not fail
+  matrix->coordinates = std::move(params.coordinates);
+
+  if (with_durations) {
+    osrmc_matrix_grow(matrix->durations, size, count);
+    osrmc_matrix_paste(matrix->durations, grown, size, 0, grown, duration_rows);
+    osrmc_matrix_paste(matrix->durations, grown, 0, size, count, duration_columns);
+  }
+
+  if (with_distances) {
+    osrmc_matrix_grow(matrix->distances, size, count);
+    osrmc_matrix_paste(matrix->distances, grown, size, 0, grown, distance_rows);
+    osrmc_matrix_paste(matrix->distances, grown, 0, size, count, distance_columns);
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_matrix_remove_coordinates(osrmc_matrix_t matrix, const size_t* indices, size_t count,
+                                     osrmc_error_t* error) try {
+  const auto size = matrix->coordinates.size();
+
+  std::vector<bool> removed(size, false);
+  for (std::size_t i = 0; i < count; ++i)
+    removed.at(indices[i]) = true;
+
+  std::vector<std::size_t> kept;
+  kept.reserve(size);
+  for (std::size_t i = 0; i < size; ++i)
+    if (!removed[i])
+      kept.emplace_back(i);
+
+  if (kept.size() == size)
+    return;
+
+  if (!matrix->durations.empty())
+    osrmc_matrix_compact(matrix->durations, size, kept);
+
+  if (!matrix->distances.empty())
+    osrmc_matrix_compact(matrix->distances, size, kept);
+
+  for (std::size_t i = 0; i < kept.size(); ++i)
+    matrix->coordinates[i] = matrix->coordinates[kept[i]];
+  matrix->coordinates.resize(kept.size());
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
 }
 
+size_t osrmc_matrix_size(osrmc_matrix_t matrix) { return matrix->coordinates.size(); }
+
+const float* osrmc_matrix_durations(osrmc_matrix_t matrix) {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  if (!osrmc_table_annotations_has(matrix->annotations, AnnotationsType::Duration))
+    return nullptr;
+
+  return matrix->durations.data();
+}
+
+const float* osrmc_matrix_distances(osrmc_matrix_t matrix) {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  if (!osrmc_table_annotations_has(matrix->annotations, AnnotationsType::Distance))
+    return nullptr;
+
+  return matrix->distances.data();
+}
+
+/* Approximate matrix */
+
+struct osrmc_approx_table final {
+  osrmc_osrm* osrm;
+  std::vector<osrm::util::Coordinate> coordinates;
+  std::vector<std::size_t> cells;           // cell per coordinate
+  std::vector<std::size_t> members;         // coordinates grouped by cell
+  std::vector<std::size_t> members_offsets; // cell's first member in members, cells + 1 entries
+  std::vector<std::size_t> representatives; // coordinate per cell
+  std::vector<std::size_t> grid;            // grid position (row * grid_columns + column) per cell
+  std::vector<std::size_t> neighbours;      // cells within one grid step of a cell, including itself
+  std::vector<std::size_t> neighbours_offsets;
+  std::size_t grid_columns;
+  std::vector<float> to_representative;
+  std::vector<float> from_representative;
+  std::vector<float> representative_durations; // cells x cells
+  float error_mean;
+  float error_max;
+};
+
+// Runs a Table request and extracts its rows x columns durations; returns false and fills error on failure.
+static bool osrmc_table_durations(osrmc_osrm& osrm, const osrm::TableParameters& params, std::size_t rows,
+                                  std::size_t columns, std::vector<float>& out, osrmc_error_t* error,
+                                  const osrmc_request& request = osrmc_request{}) {
+  osrm::json::Object result;
+
+  if (osrm.Table(params, result, request) != osrm::Status::Ok) {
+    osrmc_error_from_json(result, error);
+    return false;
+  }
+
+  out = osrmc_table_extract(result, "durations", rows, columns);
+  return true;
+}
+
+// Assigns coordinates to a grid of roughly cells cells over their bounding box; drops empty cells.
+static void osrmc_approx_table_partition(osrmc_approx_table& table, std::size_t cells) {
+  const auto count = table.coordinates.size();
+
+  double min_lon = INFINITY, min_lat = INFINITY, max_lon = -INFINITY, max_lat = -INFINITY;
+  for (const auto& coordinate : table.coordinates) {
+    min_lon = std::min(min_lon, static_cast<double>(osrm::util::toFloating(coordinate.lon)));
+    max_lon = std::max(max_lon, static_cast<double>(osrm::util::toFloating(coordinate.lon)));
+    min_lat = std::min(min_lat, static_cast<double>(osrm::util::toFloating(coordinate.lat)));
+    max_lat = std::max(max_lat, static_cast<double>(osrm::util::toFloating(coordinate.lat)));
+  }
+
+  // Keep grid cells roughly square in meters
+  const auto width = std::max(1e-9, (max_lon - min_lon) * std::cos((min_lat + max_lat) / 2. * M_PI / 180.));
+  const auto height = std::max(1e-9, max_lat - min_lat);
+
+  // Clamped so that very elongated point sets still get at most cells cells
+  const auto columns = std::min(cells, std::max<std::size_t>(1, std::lround(std::sqrt(cells * width / height))));
+  const auto rows = std::max<std::size_t>(1, cells / columns);
+
+  std::vector<std::size_t> grid(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto x = (osrm::util::toFloating(table.coordinates[i].lon) - min_lon) / std::max(1e-9, max_lon - min_lon);
+    const auto y = (osrm::util::toFloating(table.coordinates[i].lat) - min_lat) / height;
+    const auto column = std::min(columns - 1, static_cast<std::size_t>(x * columns));
+    const auto row = std::min(rows - 1, static_cast<std::size_t>(y * rows));
+    grid[i] = row * columns + column;
+  }
+
+  // Renumber non-empty grid cells densely
+  std::unordered_map<std::size_t, std::size_t> dense;
+  table.cells.resize(count);
+  for (std::size_t i = 0; i < count; ++i)
+    table.cells[i] = dense.emplace(grid[i], dense.size()).first->second;
+
+  const auto used = dense.size();
+
+  table.grid_columns = columns;
+  table.grid.resize(used);
+  for (const auto& cell : dense)
+    table.grid[cell.second] = cell.first;
+
+  // Neighbouring cells get exact durations: coordinates on either side of a boundary can be arbitrarily close
+  table.neighbours_offsets.assign(1, 0);
+  for (std::size_t cell = 0; cell < used; ++cell) {
+    const auto row = table.grid[cell] / columns;
+    const auto column = table.grid[cell] % columns;
+
+    for (auto r = row > 0 ? row - 1 : row; r <= std::min(rows - 1, row + 1); ++r) {
+      for (auto c = column > 0 ? column - 1 : column; c <= std::min(columns - 1, column + 1); ++c) {
+        const auto it = dense.find(r * columns + c);
+        if (it != dense.end())
+          table.neighbours.push_back(it->second);
+      }
+    }
+    table.neighbours_offsets.push_back(table.neighbours.size());
+  }
+
+  table.members_offsets.assign(used + 1, 0);
+  for (const auto cell : table.cells)
+    table.members_offsets[cell + 1] += 1;
+  for (std::size_t cell = 0; cell < used; ++cell)
+    table.members_offsets[cell + 1] += table.members_offsets[cell];
+
+  auto next = table.members_offsets;
+  table.members.resize(count);
+  for (std::size_t i = 0; i < count; ++i)
+    table.members[next[table.cells[i]]++] = i;
+
+  // Representative: the member closest to the cell's centroid
+  table.representatives.resize(used);
+  for (std::size_t cell = 0; cell < used; ++cell) {
+    const auto first = table.members.begin() + table.members_offsets[cell];
+    const auto last = table.members.begin() + table.members_offsets[cell + 1];
+
+    double lon = 0., lat = 0.;
+    for (auto it = first; it != last; ++it) {
+      lon += osrm::util::toFloating(table.coordinates[*it].lon);
+      lat += osrm::util::toFloating(table.coordinates[*it].lat);
+    }
+    lon /= (last - first);
+    lat /= (last - first);
+
+    table.representatives[cell] = *std::min_element(first, last, [&](std::size_t lhs, std::size_t rhs) {
+      return osrmc_haversine(lon, lat, osrm::util::toFloating(table.coordinates[lhs].lon),
+                             osrm::util::toFloating(table.coordinates[lhs].lat)) <
+             osrmc_haversine(lon, lat, osrm::util::toFloating(table.coordinates[rhs].lon),
+                             osrm::util::toFloating(table.coordinates[rhs].lat));
+    });
+  }
+}
+
+static bool osrmc_approx_table_compute(osrmc_approx_table& table, osrmc_error_t* error) {
+  const auto count = table.coordinates.size();
+  const auto cells = table.representatives.size();
+
+  // Exact representative matrix, in blocks of rows to bound the size of intermediate responses
+  const std::size_t block = 128;
+
+  osrm::TableParameters params;
+  for (const auto representative : table.representatives)
+    params.coordinates.emplace_back(table.coordinates[representative]);
+
+  table.representative_durations.reserve(cells * cells);
+
+  for (std::size_t first = 0; first < cells; first += block) {
+    const auto last = std::min(cells, first + block);
+
+    params.sources.clear();
+    for (auto i = first; i < last; ++i)
+      params.sources.emplace_back(i);
+
+    std::vector<float> rows;
+    if (!osrmc_table_durations(*table.osrm, params, last - first, cells, rows, error))
+      return false;
+
+    table.representative_durations.insert(table.representative_durations.end(), rows.begin(), rows.end());
+  }
+
+  // Snap offsets: each member to and from its representative
+  table.to_representative.resize(count);
+  table.from_representative.resize(count);
+
+  for (std::size_t cell = 0; cell < cells; ++cell) {
+    const auto first = table.members.begin() + table.members_offsets[cell];
+    const auto last = table.members.begin() + table.members_offsets[cell + 1];
+    const auto size = static_cast<std::size_t>(last - first);
+    const auto representative = static_cast<std::size_t>(std::find(first, last, table.representatives[cell]) - first);
+
+    params.coordinates.clear();
+    for (auto it = first; it != last; ++it)
+      params.coordinates.emplace_back(table.coordinates[*it]);
+
+    std::vector<float> from, to;
+
+    params.sources = {representative};
+    params.destinations.clear();
+    if (!osrmc_table_durations(*table.osrm, params, 1, size, from, error))
+      return false;
+
+    params.sources.clear();
+    params.destinations = {representative};
+    if (!osrmc_table_durations(*table.osrm, params, size, 1, to, error))
+      return false;
+
+    for (std::size_t i = 0; i < size; ++i) {
+      table.from_representative[first[i]] = from[i];
+      table.to_representative[first[i]] = to[i];
+    }
+  }
+
+  return true;
+}
+
+static bool osrmc_approx_table_near(const osrmc_approx_table& table, std::size_t from, std::size_t to) {
+  const auto from_grid = table.grid[table.cells[from]];
+  const auto to_grid = table.grid[table.cells[to]];
+
+  const auto rows = std::max(from_grid / table.grid_columns, to_grid / table.grid_columns) -
+                    std::min(from_grid / table.grid_columns, to_grid / table.grid_columns);
+  const auto columns = std::max(from_grid % table.grid_columns, to_grid % table.grid_columns) -
+                       std::min(from_grid % table.grid_columns, to_grid % table.grid_columns);
+
+  return rows <= 1 && columns <= 1;
+}
+
+static float osrmc_approx_table_estimate(const osrmc_approx_table& table, std::size_t from, std::size_t to) {
+  const auto cells = table.representatives.size();
+  return table.to_representative[from] + table.representative_durations[table.cells[from] * cells + table.cells[to]] +
+         table.from_representative[to];
+}
+
+static bool osrmc_approx_table_sample_error(osrmc_approx_table& table, std::size_t samples, osrmc_error_t* error) {
+  const auto count = table.coordinates.size();
+  samples = std::min(samples, count);
+
+  table.error_mean = 0.f;
+  table.error_max = 0.f;
+
+  if (samples < 2)
+    return true;
+
+  // Partial Fisher-Yates shuffle with a fixed seed for reproducible estimates
+  std::vector<std::size_t> indices(count);
+  for (std::size_t i = 0; i < count; ++i)
+    indices[i] = i;
+
+  std::mt19937 generator{42};
+  for (std::size_t i = 0; i < samples; ++i) {
+    std::uniform_int_distribution<std::size_t> pick{i, count - 1};
+    std::swap(indices[i], indices[pick(generator)]);
+  }
+  indices.resize(samples);
+
+  osrm::TableParameters params;
+  for (const auto index : indices)
+    params.coordinates.emplace_back(table.coordinates[index]);
+
+  std::vector<float> exact;
+  if (!osrmc_table_durations(*table.osrm, params, samples, samples, exact, error))
+    return false;
+
+  double sum = 0.;
+  std::size_t compared = 0;
+
+  for (std::size_t i = 0; i < samples; ++i) {
+    for (std::size_t j = 0; j < samples; ++j) {
+      const auto from = indices[i];
+      const auto to = indices[j];
+      const auto truth = exact[i * samples + j];
+
+      if (osrmc_approx_table_near(table, from, to) || !std::isfinite(truth) || truth <= 0.f)
+        continue;
+
+      const auto estimate = osrmc_approx_table_estimate(table, from, to);
+      if (!std::isfinite(estimate))
+        continue;
+
+      const auto relative = std::abs(estimate - truth) / truth;
+      sum += relative;
+      table.error_max = std::max(table.error_max, relative);
+      compared += 1;
+    }
+  }
+
+  if (compared > 0)
+    table.error_mean = sum / compared;
+
+  return true;
+}
+
+osrmc_approx_table_t osrmc_approx_table_construct(osrmc_osrm_t osrm, const float* longitudes, const float* latitudes,
+                                                  size_t count, size_t cells, size_t samples,
+                                                  osrmc_error_t* error) try {
+  if (count == 0 || cells == 0)
+    throw std::invalid_argument("Approximate table requires coordinates and cells");
+
+  std::unique_ptr<osrmc_approx_table> out{new osrmc_approx_table};
+  out->osrm = osrm;
+
+  out->coordinates.reserve(count);
+  for (std::size_t i = 0; i < count; ++i)
+    out->coordinates.emplace_back(osrm::util::FloatLongitude{longitudes[i]}, osrm::util::FloatLatitude{latitudes[i]});
+
+  osrmc_approx_table_partition(*out, cells);
+
+  if (!osrmc_approx_table_compute(*out, error))
+    return nullptr;
+
+  if (!osrmc_approx_table_sample_error(*out, samples, error))
+    return nullptr;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_approx_table_destruct(osrmc_approx_table_t table) { delete table; }
+
+size_t osrmc_approx_table_cells(osrmc_approx_table_t table) { return table->representatives.size(); }
+
+float osrmc_approx_table_error_mean(osrmc_approx_table_t table) { return table->error_mean; }
+
+float osrmc_approx_table_error_max(osrmc_approx_table_t table) { return table->error_max; }
+
+float osrmc_approx_table_duration(osrmc_approx_table_t table, unsigned long from, unsigned long to,
+                                  osrmc_error_t* error) try {
+  if (from >= table->cells.size() || to >= table->cells.size())
+    throw std::out_of_range("Coordinate index out of range");
+
+  if (from == to)
+    return 0.f;
+
+  if (!osrmc_approx_table_near(*table, from, to))
+    return osrmc_approx_table_estimate(*table, from, to);
+
+  osrm::TableParameters params;
+  params.coordinates = {table->coordinates[from], table->coordinates[to]};
+  params.sources = {0};
+  params.destinations = {1};
+
+  std::vector<float> exact;
+  if (!osrmc_table_durations(*table->osrm, params, 1, 1, exact, error))
+    return INFINITY;
+
+  return exact[0];
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return INFINITY;
+}
+
+void osrmc_approx_table_row(osrmc_approx_table_t table, unsigned long from, float* row, osrmc_error_t* error) try {
+  const auto cell = table->cells.at(from);
+  const auto count = table->coordinates.size();
+
+  for (std::size_t to = 0; to < count; ++to)
+    if (!osrmc_approx_table_near(*table, from, to))
+      row[to] = osrmc_approx_table_estimate(*table, from, to);
+
+  // Exact one-to-many durations to the source's cell and its neighbours
+  std::vector<std::size_t> near;
+  for (auto i = table->neighbours_offsets[cell]; i < table->neighbours_offsets[cell + 1]; ++i) {
+    const auto neighbour = table->neighbours[i];
+    near.insert(near.end(), table->members.begin() + table->members_offsets[neighbour],
+                table->members.begin() + table->members_offsets[neighbour + 1]);
+  }
+  const auto size = near.size();
+
+  osrm::TableParameters params;
+  params.coordinates.emplace_back(table->coordinates[from]);
+  for (const auto index : near)
+    params.coordinates.emplace_back(table->coordinates[index]);
+
+  params.sources = {0};
+  for (std::size_t i = 1; i <= size; ++i)
+    params.destinations.emplace_back(i);
+
+  std::vector<float> exact;
+  if (!osrmc_table_durations(*table->osrm, params, 1, size, exact, error))
+    return;
+
+  for (std::size_t i = 0; i < size; ++i)
+    row[near[i]] = exact[i];
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Isochrones */
+
+struct osrmc_isochrone_params final {
+  osrm::util::Coordinate origin;
+  std::vector<float> thresholds;
+  unsigned cells = 16;
+  unsigned depth = 3;
+  float max_speed = 33.3f; // meters per second, bounds the sampled area
+  unsigned threads = 0;    // zero uses the hardware concurrency
+  unsigned deadline = 0;   // milliseconds for the whole isochrone, zero means none
+  int priority = 0;
+};
+
+static const unsigned osrmc_isochrone_max_side = 4096;
+
+struct osrmc_isochrone_response final {
+  std::vector<std::vector<std::vector<float>>> rings; // per threshold, per ring, interleaved lon, lat
+  std::size_t samples;
+};
+
+// Square sampling lattice around the origin; size points per side, durations NAN until evaluated.
+struct osrmc_isochrone_grid final {
+  std::size_t size;
+  double west, south, step_lon, step_lat;
+  std::vector<float> durations;
+
+  float& At(std::size_t x, std::size_t y) { return durations[y * size + x]; }
+
+  // Outside the lattice everything counts as unreachable, which closes all rings
+  float Value(std::ptrdiff_t x, std::ptrdiff_t y) const {
+    if (x < 0 || y < 0 || x >= static_cast<std::ptrdiff_t>(size) || y >= static_cast<std::ptrdiff_t>(size))
+      return INFINITY;
+    return durations[y * size + x];
+  }
+
+  osrm::util::Coordinate Location(std::size_t x, std::size_t y) const {
+    return {osrm::util::FloatLongitude{west + x * step_lon}, osrm::util::FloatLatitude{south + y * step_lat}};
+  }
+};
+
+// Evaluates origin to point durations with one-to-many Table requests spread over parallel batches.
+static bool osrmc_isochrone_evaluate(osrmc_osrm& osrm, const osrmc_isochrone_params& params,
+                                     const osrmc_request& request, osrmc_isochrone_grid& grid,
+                                     const std::vector<std::size_t>& points, osrmc_error_t* error) {
+  const std::size_t batch = 1000;
+  const auto batches = (points.size() + batch - 1) / batch;
+
+  auto threads = params.threads > 0 ? params.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = static_cast<unsigned>(std::min<std::size_t>(threads, batches));
+
+  std::atomic<std::size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::mutex failure;
+  osrmc_error_t first_error = nullptr;
+  osrmc_status_t first_status = OSRMC_OK;
+  std::string first_message;
+
+  // Never throws: an exception escaping on the calling thread would destroy joinable workers
+  const auto work = [&] {
+    for (auto index = next++; index < batches && !failed; index = next++) {
+      const auto first = index * batch;
+      const auto last = std::min(points.size(), first + batch);
+
+      std::vector<float> durations;
+      osrmc_error_t batch_error = nullptr;
+      auto ok = false;
+
+      try {
+        osrm::TableParameters table;
+        table.coordinates.reserve(last - first + 1);
+        table.coordinates.emplace_back(params.origin);
+        table.sources = {0};
+
+        for (auto i = first; i < last; ++i) {
+          table.coordinates.emplace_back(grid.Location(points[i] % grid.size, points[i] / grid.size));
+          table.destinations.emplace_back(i - first + 1);
+        }
+
+        ok = osrmc_table_durations(osrm, table, 1, last - first, durations, error ? &batch_error : nullptr,
+                                   request);
+      } catch (const std::exception& e) {
+        osrmc_error_from_exception(e, error ? &batch_error : nullptr);
+      }
+
+      if (!ok) {
+        std::lock_guard<std::mutex> lock{failure};
+        if (!failed.exchange(true)) {
+          first_error = batch_error;
+          first_status = osrmc_last_status();
+          first_message = osrmc_last_message();
+        } else if (batch_error) {
+          osrmc_error_destruct(batch_error);
+        }
+        return;
+      }
+
+      for (auto i = first; i < last; ++i)
+        grid.durations[points[i]] = durations[i - first];
+    }
+  };
+
+  std::vector<std::thread> workers;
+  try {
+    for (unsigned i = 1; i < threads; ++i)
+      workers.emplace_back(work);
+  } catch (const std::exception&) {
+    // Out of threads or memory: the workers already running and this thread share all batches
+  }
+  work();
+  for (auto& worker : workers)
+    worker.join();
+
+  if (failed) {
+    // Surface the first failure on the calling thread as well
+    osrmc_error_set(first_status, first_message.c_str(), nullptr);
+    if (error)
+      *error = first_error;
+  }
+
+  return !failed;
+}
+
+// Whether the square cell with lower left corner (x, y) and side step has any threshold between its corners.
+static bool osrmc_isochrone_straddles(const osrmc_isochrone_grid& grid, const std::vector<float>& thresholds,
+                                      std::size_t x, std::size_t y, std::size_t step) {
+  const float corners[] = {grid.Value(x, y), grid.Value(x + step, y), grid.Value(x, y + step),
+                           grid.Value(x + step, y + step)};
+
+  const auto lowest = *std::min_element(std::begin(corners), std::end(corners));
+  const auto highest = *std::max_element(std::begin(corners), std::end(corners));
+
+  for (const auto threshold : thresholds)
+    if (lowest <= threshold && !(highest <= threshold))
+      return true;
+
+  return false;
+}
+
+// Samples the coarse lattice, then repeatedly halves the step inside cells at or next to a contour.
+// Points never sampled are interpolated from the enclosing coarser cell; they lie away from any contour.
+static bool osrmc_isochrone_sample(osrmc_osrm& osrm, const osrmc_isochrone_params& params,
+                                   const osrmc_request& request, osrmc_isochrone_grid& grid, std::size_t& samples,
+                                   osrmc_error_t* error) {
+  const std::size_t coarse = std::size_t{1} << params.depth;
+
+  std::vector<std::size_t> points;
+  for (std::size_t y = 0; y < grid.size; y += coarse)
+    for (std::size_t x = 0; x < grid.size; x += coarse)
+      points.emplace_back(y * grid.size + x);
+
+  if (!osrmc_isochrone_evaluate(osrm, params, request, grid, points, error))
+    return false;
+  samples = points.size();
+
+  for (auto step = coarse; step > 1; step /= 2) {
+    const auto half = step / 2;
+    const auto cells = (grid.size - 1) / step;
+
+    std::vector<bool> marked(cells * cells, false);
+    for (std::size_t cy = 0; cy < cells; ++cy)
+      for (std::size_t cx = 0; cx < cells; ++cx)
+        if (osrmc_isochrone_straddles(grid, params.thresholds, cx * step, cy * step, step))
+          for (std::size_t ny = cy > 0 ? cy - 1 : 0; ny <= std::min(cells - 1, cy + 1); ++ny)
+            for (std::size_t nx = cx > 0 ? cx - 1 : 0; nx <= std::min(cells - 1, cx + 1); ++nx)
+              marked[ny * cells + nx] = true;
+
+    points.clear();
+    for (std::size_t cy = 0; cy < cells; ++cy)
+      for (std::size_t cx = 0; cx < cells; ++cx) {
+        if (!marked[cy * cells + cx])
+          continue;
+        for (auto y = cy * step; y <= (cy + 1) * step; y += half)
+          for (auto x = cx * step; x <= (cx + 1) * step; x += half)
+            if (std::isnan(grid.At(x, y)))
+              points.emplace_back(y * grid.size + x);
+      }
+
+    std::sort(points.begin(), points.end());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+
+    if (!osrmc_isochrone_evaluate(osrm, params, request, grid, points, error))
+      return false;
+    samples += points.size();
+
+    // Fill the remaining points of this level from their coarser neighbours
+    for (std::size_t y = 0; y < grid.size; y += half)
+      for (std::size_t x = 0; x < grid.size; x += half) {
+        auto& value = grid.At(x, y);
+        if (!std::isnan(value))
+          continue;
+
+        if (x % step == 0)
+          value = (grid.At(x, y - half) + grid.At(x, y + half)) / 2.f;
+        else if (y % step == 0)
+          value = (grid.At(x - half, y) + grid.At(x + half, y)) / 2.f;
+        else
+          value = (grid.At(x - half, y - half) + grid.At(x + half, y - half) + grid.At(x - half, y + half) +
+                   grid.At(x + half, y + half)) /
+                  4.f;
+      }
+  }
+
+  return true;
+}
+
+// Marching squares over the lattice for one threshold, chaining segments into closed rings.
+static std::vector<std::vector<float>> osrmc_isochrone_contour(const osrmc_isochrone_grid& grid, float threshold) {
+  // Edges are keyed by their lower left lattice point (shifted by one for the outside frame) and direction
+  const auto width = static_cast<std::ptrdiff_t>(grid.size) + 2;
+  const auto edge_key = [&](std::ptrdiff_t x, std::ptrdiff_t y, bool vertical) {
+    return static_cast<std::size_t>(((y + 1) * width + (x + 1)) * 2 + vertical);
+  };
+
+  const auto inside = [&](std::ptrdiff_t x, std::ptrdiff_t y) { return grid.Value(x, y) <= threshold; };
+
+  // Position of the contour crossing on the edge from a to b in lattice units
+  const auto crossing = [&](std::ptrdiff_t ax, std::ptrdiff_t ay, std::ptrdiff_t bx, std::ptrdiff_t by) {
+    const auto a = grid.Value(ax, ay);
+    const auto b = grid.Value(bx, by);
+    auto t = 0.5;
+    if (std::isfinite(a) && std::isfinite(b) && a != b)
+      t = std::min(1., std::max(0., (threshold - a) / static_cast<double>(b - a)));
+    return std::make_pair(ax + t * (bx - ax), ay + t * (by - ay));
+  };
+
+  struct Segment {
+    std::size_t edges[2];
+    std::pair<double, double> points[2];
+  };
+
+  // Edges per marching squares case: 0 bottom, 1 right, 2 top, 3 left
+  static const int cases[16][4] = {{-1, -1, -1, -1}, {3, 0, -1, -1}, {0, 1, -1, -1}, {3, 1, -1, -1},
+                                   {1, 2, -1, -1},   {-1, -1, -1, -1}, {0, 2, -1, -1}, {3, 2, -1, -1},
+                                   {2, 3, -1, -1},   {0, 2, -1, -1}, {-1, -1, -1, -1}, {1, 2, -1, -1},
+                                   {1, 3, -1, -1},   {0, 1, -1, -1}, {3, 0, -1, -1},   {-1, -1, -1, -1}};
+
+  std::vector<Segment> segments;
+  std::unordered_map<std::size_t, std::vector<std::size_t>> by_edge;
+
+  const auto size = static_cast<std::ptrdiff_t>(grid.size);
+
+  for (std::ptrdiff_t y = -1; y < size; ++y) {
+    for (std::ptrdiff_t x = -1; x < size; ++x) {
+      const auto index = inside(x, y) | inside(x + 1, y) << 1 | inside(x + 1, y + 1) << 2 | inside(x, y + 1) << 3;
+
+      const std::size_t keys[] = {edge_key(x, y, false), edge_key(x + 1, y, true), edge_key(x, y + 1, false),
+                                  edge_key(x, y, true)};
+      const std::pair<double, double> points[] = {crossing(x, y, x + 1, y), crossing(x + 1, y, x + 1, y + 1),
+                                                  crossing(x, y + 1, x + 1, y + 1), crossing(x, y, x, y + 1)};
+
+      int edges[4];
+      std::copy(std::begin(cases[index]), std::end(cases[index]), std::begin(edges));
+
+      // Saddles: resolve by the average of the four corners
+      if (index == 5 || index == 10) {
+        const auto center = (grid.Value(x, y) + grid.Value(x + 1, y) + grid.Value(x + 1, y + 1) +
+                             grid.Value(x, y + 1)) / 4.f <= threshold;
+        const int around_bottom_right_top_left[] = {0, 1, 2, 3};
+        const int around_bottom_left_top_right[] = {3, 0, 1, 2};
+        const auto& chosen = (index == 5) == center ? around_bottom_right_top_left : around_bottom_left_top_right;
+        std::copy(std::begin(chosen), std::end(chosen), std::begin(edges));
+      }
+
+      for (auto i = 0; i < 4 && edges[i] >= 0; i += 2) {
+        const auto id = segments.size();
+        segments.push_back(Segment{{keys[edges[i]], keys[edges[i + 1]]}, {points[edges[i]], points[edges[i + 1]]}});
+        by_edge[keys[edges[i]]].push_back(id);
+        by_edge[keys[edges[i + 1]]].push_back(id);
+      }
+    }
+  }
+
+  std::vector<std::vector<float>> rings;
+  std::vector<bool> used(segments.size(), false);
+
+  const auto emit = [&](std::vector<float>& ring, const std::pair<double, double>& point) {
+    ring.push_back(grid.west + point.first * grid.step_lon);
+    ring.push_back(grid.south + point.second * grid.step_lat);
+  };
+
+  for (std::size_t start = 0; start < segments.size(); ++start) {
+    if (used[start])
+      continue;
+
+    std::vector<float> ring;
+    emit(ring, segments[start].points[0]);
+
+    auto current = start;
+    auto exit = 1;
+
+    for (;;) {
+      used[current] = true;
+      emit(ring, segments[current].points[exit]);
+
+      const auto edge = segments[current].edges[exit];
+      const auto& candidates = by_edge[edge];
+      const auto next = std::find_if(candidates.begin(), candidates.end(), [&](std::size_t id) { return !used[id]; });
+
+      if (next == candidates.end())
+        break;
+
+      current = *next;
+      exit = segments[current].edges[0] == edge ? 1 : 0;
+    }
+
+    rings.emplace_back(std::move(ring));
+  }
+
+  return rings;
+}
+
+osrmc_isochrone_params_t osrmc_isochrone_params_construct(float longitude, float latitude,
+                                                          osrmc_error_t* error) try {
+  auto* out = new osrmc_isochrone_params;
+  out->origin = osrm::util::Coordinate{osrm::util::FloatLongitude{longitude}, osrm::util::FloatLatitude{latitude}};
+  return out;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_isochrone_params_destruct(osrmc_isochrone_params_t params) { delete params; }
+
+void osrmc_isochrone_params_add_threshold(osrmc_isochrone_params_t params, float seconds, osrmc_error_t* error) try {
+  params->thresholds.emplace_back(seconds);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_isochrone_params_set_resolution(osrmc_isochrone_params_t params, unsigned cells, unsigned depth,
+                                           osrmc_error_t* error) {
+  cells = std::max(1u, cells);
+  depth = std::min(depth, 8u);
+
+  // The lattice holds (cells * 2^depth + 1)^2 durations: 4096 per side are 64 MiB
+  if (cells > osrmc_isochrone_max_side >> depth) {
+    osrmc_error_set(OSRMC_ERROR_INVALID_VALUE, "Isochrone resolution exceeds 4096 points per side", error);
+    return;
+  }
+
+  params->cells = cells;
+  params->depth = depth;
+}
+
+void osrmc_isochrone_params_set_max_speed(osrmc_isochrone_params_t params, float meters_per_second) {
+  params->max_speed = meters_per_second;
+}
+
+void osrmc_isochrone_params_set_threads(osrmc_isochrone_params_t params, unsigned threads) {
+  params->threads = threads;
+}
+
+void osrmc_isochrone_params_set_deadline(osrmc_isochrone_params_t params, unsigned milliseconds) {
+  params->deadline = milliseconds;
+}
+
+void osrmc_isochrone_params_set_priority(osrmc_isochrone_params_t params, int priority) {
+  params->priority = priority;
+}
+
+osrmc_isochrone_response_t osrmc_isochrone(osrmc_osrm_t osrm, osrmc_isochrone_params_t params,
+                                           osrmc_error_t* error) try {
+  if (params->thresholds.empty())
+    throw std::invalid_argument("Isochrone requires at least one threshold");
+
+  // All Table requests of this isochrone share one deadline
+  const osrmc_request request{params->deadline, params->priority};
+
+  const auto longitude = static_cast<double>(osrm::util::toFloating(params->origin.lon));
+  const auto latitude = static_cast<double>(osrm::util::toFloating(params->origin.lat));
+
+  // Nothing beyond the largest threshold at maximum speed can be reached
+  const auto horizon = *std::max_element(params->thresholds.begin(), params->thresholds.end());
+  const auto radius = std::max(1., static_cast<double>(horizon) * params->max_speed);
+
+  const double meters_per_degree = 111319.49;
+  const auto radius_lat = radius / meters_per_degree;
+  const auto radius_lon = radius / (meters_per_degree * std::max(0.01, std::cos(latitude * M_PI / 180.)));
+
+  osrmc_isochrone_grid grid;
+  grid.size = static_cast<std::size_t>(params->cells) * (std::size_t{1} << params->depth) + 1;
+  grid.west = longitude - radius_lon;
+  grid.south = latitude - radius_lat;
+  grid.step_lon = 2. * radius_lon / (grid.size - 1);
+  grid.step_lat = 2. * radius_lat / (grid.size - 1);
+  grid.durations.assign(grid.size * grid.size, NAN);
+
+  std::unique_ptr<osrmc_isochrone_response> out{new osrmc_isochrone_response};
+
+  if (!osrmc_isochrone_sample(*osrm, *params, request, grid, out->samples, error))
+    return nullptr;
+
+  for (const auto threshold : params->thresholds)
+    out->rings.emplace_back(osrmc_isochrone_contour(grid, threshold));
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_isochrone_response_destruct(osrmc_isochrone_response_t response) { delete response; }
+
+size_t osrmc_isochrone_response_samples(osrmc_isochrone_response_t response) { return response->samples; }
+
+size_t osrmc_isochrone_response_rings(osrmc_isochrone_response_t response, size_t threshold) {
+  return response->rings.at(threshold).size();
+}
+
+const float* osrmc_isochrone_response_ring(osrmc_isochrone_response_t response, size_t threshold, size_t ring,
+                                           size_t* count) {
+  const auto& coordinates = response->rings.at(threshold).at(ring);
+  *count = coordinates.size() / 2;
+  return coordinates.data();
+}
+
+osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error) try {
+  return new osrmc_nearest_params;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_nearest_params_destruct(osrmc_nearest_params_t params) { delete params; }
+
+void osrmc_nearest_params_set_deadline(osrmc_nearest_params_t params, unsigned milliseconds) {
+  params->deadline = milliseconds;
+}
+
+void osrmc_nearest_params_set_priority(osrmc_nearest_params_t params, int priority) { params->priority = priority; }
+
+osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error) try {
+  return new osrmc_match_params;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_match_params_destruct(osrmc_match_params_t params) { delete params; }
+
+void osrmc_match_params_set_deadline(osrmc_match_params_t params, unsigned milliseconds) {
+  params->deadline = milliseconds;
+}
+
+void osrmc_match_params_set_priority(osrmc_match_params_t params, int priority) { params->priority = priority; }
+
+void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n) {
+  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
+  params_typed->number_of_results = n;
+}
+
+void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
+  params_typed->timestamps.emplace_back(timestamp);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Streaming visitor */
+
+static double osrmc_json_number(const osrm::json::Object& object, const char* key) {
+  const auto found = object.values.find(key);
+  if (found == object.values.end() || !found->second.is<osrm::json::Number>())
+    return NAN;
+  return found->second.get<osrm::json::Number>().value;
+}
+
+static const char* osrmc_json_string(const osrm::json::Object& object, const char* key) {
+  const auto found = object.values.find(key);
+  if (found == object.values.end() || !found->second.is<osrm::json::String>())
+    return "";
+  return found->second.get<osrm::json::String>().value.c_str();
+}
+
+// Walks a response depth-first, emitting generic events and the typed shortcuts where the structure matches.
+struct osrmc_json_walker final {
+  enum class Context { Response, Route, Leg, Other };
+
+  const osrmc_visitor_t& visitor;
+  void* data;
+
+  void Value(const osrm::json::Value& value) {
+    if (value.is<osrm::json::Object>())
+      Object(value.get<osrm::json::Object>(), Context::Other, 0, 0);
+    else if (value.is<osrm::json::Array>())
+      Array(value.get<osrm::json::Array>());
+    else if (value.is<osrm::json::String>()) {
+      const auto& string = value.get<osrm::json::String>().value;
+      if (visitor.string)
+        visitor.string(data, string.c_str(), string.size());
+    } else if (value.is<osrm::json::Number>()) {
+      if (visitor.number)
+        visitor.number(data, value.get<osrm::json::Number>().value);
+    } else if (value.is<osrm::json::True>() || value.is<osrm::json::False>()) {
+      if (visitor.boolean)
+        visitor.boolean(data, value.is<osrm::json::True>());
+    } else if (visitor.null) {
+      visitor.null(data);
+    }
+  }
+
+  void Array(const osrm::json::Array& array) {
+    if (visitor.begin_array)
+      visitor.begin_array(data);
+    for (const auto& value : array.values)
+      Value(value);
+    if (visitor.end_array)
+      visitor.end_array(data);
+  }
+
+  void Object(const osrm::json::Object& object, Context context, std::size_t route, std::size_t leg) {
+    if (visitor.begin_object)
+      visitor.begin_object(data);
+
+    for (const auto& member : object.values) {
+      const auto& key = member.first;
+      const auto& value = member.second;
+
+      if (visitor.key)
+        visitor.key(data, key.c_str(), key.size());
+
+      const auto is_array = value.is<osrm::json::Array>();
+
+      if (context == Context::Response && is_array && (key == "routes" || key == "matchings"))
+        Nested(value.get<osrm::json::Array>(), Context::Route, route, leg);
+      else if (context == Context::Route && is_array && key == "legs")
+        Nested(value.get<osrm::json::Array>(), Context::Leg, route, leg);
+      else if (context == Context::Leg && is_array && key == "steps")
+        Nested(value.get<osrm::json::Array>(), Context::Other, route, leg);
+      else if (context == Context::Response && is_array && visitor.table_row &&
+               (key == "durations" || key == "distances"))
+        TableRows(key.c_str(), value.get<osrm::json::Array>());
+      else
+        Value(value);
+    }
+
+    if (visitor.end_object)
+      visitor.end_object(data);
+  }
+
+  // Arrays of routes, legs or steps: context is the context of their elements.
+  void Nested(const osrm::json::Array& array, Context context, std::size_t route, std::size_t leg) {
+    if (visitor.begin_array)
+      visitor.begin_array(data);
+
+    for (std::size_t i = 0; i < array.values.size(); ++i) {
+      const auto& element = array.values[i];
+
+      if (!element.is<osrm::json::Object>()) {
+        Value(element);
+        continue;
+      }
+
+      const auto& object = element.get<osrm::json::Object>();
+      const auto distance = osrmc_json_number(object, "distance");
+      const auto duration = osrmc_json_number(object, "duration");
+
+      if (context == Context::Route) {
+        if (visitor.route)
+          visitor.route(data, i, distance, duration);
+        Object(object, context, i, 0);
+      } else if (context == Context::Leg) {
+        if (visitor.leg)
+          visitor.leg(data, route, i, distance, duration);
+        Object(object, context, route, i);
+      } else {
+        if (visitor.step)
+          visitor.step(data, route, leg, i, osrmc_json_string(object, "name"), distance, duration);
+        Object(object, context, route, leg);
+      }
+    }
+
+    if (visitor.end_array)
+      visitor.end_array(data);
+  }
+
+  // Bracketed by begin_array and end_array so that the preceding key event still gets a well-formed value.
+  void TableRows(const char* annotation, const osrm::json::Array& rows) {
+    if (visitor.begin_array)
+      visitor.begin_array(data);
+
+    std::vector<float> values;
+
+    for (std::size_t row = 0; row < rows.values.size(); ++row) {
+      const auto& cells = rows.values[row].get<osrm::json::Array>().values;
+
+      values.clear();
+      for (const auto& cell : cells)
+        values.push_back(cell.is<osrm::json::Null>() ? INFINITY : cell.get<osrm::json::Number>().value);
+
+      visitor.table_row(data, annotation, row, values.data(), values.size());
+    }
+
+    if (visitor.end_array)
+      visitor.end_array(data);
+  }
+};
+
+static void osrmc_visit(osrm::json::Object& response, const osrmc_visitor_t* visitor, void* data) {
+  osrmc_json_walker walker{*visitor, data};
+  walker.Object(response, osrmc_json_walker::Context::Response, 0, 0);
+}
+
+osrmc_visitor_t* osrmc_visitor_construct(osrmc_error_t* error) try {
+  return new osrmc_visitor_t{};
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_visitor_destruct(osrmc_visitor_t* visitor) { delete visitor; }
+
+void osrmc_visitor_set_route(osrmc_visitor_t* visitor, void (*route)(void*, size_t, double, double)) {
+  visitor->route = route;
+}
+
+void osrmc_route_visit(osrmc_osrm_t osrm, osrmc_route_params_t params, const osrmc_visitor_t* visitor, void* data,
+                       osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  osrm::json::Object result;
+  if (osrm->Route(*params_typed, result, params->Request()) != osrm::Status::Ok) {
+    osrmc_error_from_json(result, error);
+    return;
+  }
+
+  osrmc_visit(result, visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_visit(osrmc_osrm_t osrm, osrmc_table_params_t params, const osrmc_visitor_t* visitor, void* data,
+                       osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+
+  osrm::json::Object result;
+  if (osrm->Table(*params_typed, result, params->Request()) != osrm::Status::Ok) {
+    osrmc_error_from_json(result, error);
+    return;
+  }
+
+  osrmc_visit(result, visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_nearest_visit(osrmc_osrm_t osrm, osrmc_nearest_params_t params, const osrmc_visitor_t* visitor, void* data,
+                         osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
+
+  osrm::json::Object result;
+  if (osrm->Nearest(*params_typed, result, params->Request()) != osrm::Status::Ok) {
+    osrmc_error_from_json(result, error);
+    return;
+  }
+
+  osrmc_visit(result, visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_match_visit(osrmc_osrm_t osrm, osrmc_match_params_t params, const osrmc_visitor_t* visitor, void* data,
+                       osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
+
+  osrm::json::Object result;
+  if (osrm->Match(*params_typed, result, params->Request()) != osrm::Status::Ok) {
+    osrmc_error_from_json(result, error);
+    return;
+  }
+
+  osrmc_visit(result, visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_response_visit(osrmc_route_response_t response, const osrmc_visitor_t* visitor, void* data,
+                                osrmc_error_t* error) try {
+  osrmc_visit(*reinterpret_cast<osrm::json::Object*>(response), visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_response_visit(osrmc_table_response_t response, const osrmc_visitor_t* visitor, void* data,
+                                osrmc_error_t* error) try {
+  osrmc_visit(*reinterpret_cast<osrm::json::Object*>(response), visitor, data);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Warm-up and startup profiling */
+
+struct osrmc_warmup_params final {
+  std::vector<osrm::util::Coordinate> coordinates;
+  bool prefault = false; // the engine reads files into its own memory, see osrmc_warmup_params_set_prefault
+  unsigned routes = 0;
+  unsigned tables = 0;
+  unsigned table_size = 0;
+};
+
+struct osrmc_startup_file final {
+  std::string path;
+  std::size_t bytes;
+  std::size_t resident_bytes;
+  float seconds;
+};
+
+struct osrmc_startup_report final {
+  float load_seconds;
+  float first_query_seconds;
+  std::vector<float> query_seconds; // sorted
+  std::vector<osrmc_startup_file> files;
+};
+
+osrmc_warmup_params_t osrmc_warmup_params_construct(osrmc_error_t* error) try {
+  return new osrmc_warmup_params;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_warmup_params_destruct(osrmc_warmup_params_t params) { delete params; }
+
+void osrmc_warmup_params_add_coordinate(osrmc_warmup_params_t params, float longitude, float latitude,
+                                        osrmc_error_t* error) try {
+  params->coordinates.emplace_back(osrm::util::FloatLongitude{longitude}, osrm::util::FloatLatitude{latitude});
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_warmup_params_set_prefault(osrmc_warmup_params_t params, int on) { params->prefault = on; }
+
+void osrmc_warmup_params_set_routes(osrmc_warmup_params_t params, unsigned n) { params->routes = n; }
+
+void osrmc_warmup_params_set_tables(osrmc_warmup_params_t params, unsigned n, unsigned size) {
+  params->tables = n;
+  params->table_size = size;
+}
+
+// Dataset files are the base path itself and all files extending it, e.g. map.osrm and map.osrm.hsgr.
+static std::vector<std::string> osrmc_dataset_files(const std::string& base_path) {
+  std::vector<std::string> files;
+
+  if (base_path.empty())
+    return files;
+
+  const auto slash = base_path.find_last_of('/');
+  const auto directory = slash == std::string::npos ? std::string{"."} : base_path.substr(0, slash);
+  const auto prefix = slash == std::string::npos ? base_path : base_path.substr(slash + 1);
+
+  std::unique_ptr<DIR, int (*)(DIR*)> dir{::opendir(directory.c_str()), ::closedir};
+  if (!dir)
+    throw std::runtime_error("Unable to open dataset directory " + directory);
+
+  while (const auto* entry = ::readdir(dir.get())) {
+    const std::string name{entry->d_name};
+    if (name == prefix || name.compare(0, prefix.size() + 1, prefix + ".") == 0)
+      files.emplace_back(directory + "/" + name);
+  }
+
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// Maps a file, advises the kernel to read it ahead, touches every page and counts the resident bytes.
+static osrmc_startup_file osrmc_prefault_file(const std::string& path, bool prefault) {
+  const auto start = std::chrono::steady_clock::now();
+
+  osrmc_startup_file out{path, 0, 0, 0.f};
+
+  const auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return out;
+
+  struct stat info;
+  if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+    ::close(fd);
+    return out;
+  }
+
+  out.bytes = info.st_size;
+
+  auto* data = ::mmap(nullptr, out.bytes, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (data == MAP_FAILED)
+    return out;
+
+  const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+
+  if (prefault) {
+    ::madvise(data, out.bytes, MADV_WILLNEED);
+
+    volatile unsigned char sink = 0;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t offset = 0; offset < out.bytes; offset += page)
+      sink ^= bytes[offset];
+    (void)sink;
+  }
+
+  std::vector<unsigned char> pages((out.bytes + page - 1) / page);
+  if (::mincore(data, out.bytes, pages.data()) == 0)
+    for (std::size_t i = 0; i < pages.size(); ++i)
+      if (pages[i] & 1)
+        out.resident_bytes += std::min(page, out.bytes - i * page);
+
+  ::munmap(data, out.bytes);
+
+  out.seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+  return out;
+}
+
+osrmc_startup_report_t osrmc_warmup(osrmc_osrm_t osrm, osrmc_warmup_params_t params, osrmc_error_t* error) try {
+  std::unique_ptr<osrmc_startup_report> out{new osrmc_startup_report};
+  out->load_seconds = osrm->load_seconds;
+
+  for (const auto& path : osrmc_dataset_files(osrm->base_path))
+    out->files.emplace_back(osrmc_prefault_file(path, params->prefault));
+
+  const auto& coordinates = params->coordinates;
+
+  if ((params->routes > 0 || params->tables > 0) && coordinates.size() < 2)
+    throw std::invalid_argument("Warm-up queries require at least two coordinates");
+
+  std::mt19937 generator{42};
+  std::uniform_int_distribution<std::size_t> pick{0, coordinates.empty() ? 0 : coordinates.size() - 1};
+
+  const auto timed = [&](const std::function<void()>& query) {
+    const auto start = std::chrono::steady_clock::now();
+    query();
+    const auto stop = std::chrono::steady_clock::now();
+
+    out->query_seconds.emplace_back(std::chrono::duration<float>(stop - start).count());
+  };
+
+  for (unsigned i = 0; i < params->routes; ++i) {
+    osrm::RouteParameters route;
+    route.coordinates = {coordinates[pick(generator)], coordinates[pick(generator)]};
+
+    timed([&] {
+      osrm::json::Object result;
+      (void)osrm->Route(route, result);
+    });
+  }
+
+  for (unsigned i = 0; i < params->tables; ++i) {
+    osrm::TableParameters table;
+    for (unsigned j = 0; j < std::max(2u, params->table_size); ++j)
+      table.coordinates.emplace_back(coordinates[pick(generator)]);
+
+    timed([&] {
+      osrm::json::Object result;
+      (void)osrm->Table(table, result);
+    });
+  }
+
+  std::sort(out->query_seconds.begin(), out->query_seconds.end());
+
+  out->first_query_seconds = osrm->first_query_seconds.load();
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_startup_report_destruct(osrmc_startup_report_t report) { delete report; }
+
+float osrmc_startup_report_load_seconds(osrmc_startup_report_t report) { return report->load_seconds; }
+
+float osrmc_startup_report_first_query_seconds(osrmc_startup_report_t report) { return report->first_query_seconds; }
+
+float osrmc_startup_report_query_seconds(osrmc_startup_report_t report, float percentile) {
+  const auto& seconds = report->query_seconds;
+
+  if (seconds.empty())
+    return NAN;
+
+  const auto clamped = std::min(100.f, std::max(0.f, percentile));
+  const auto rank = static_cast<std::size_t>(std::ceil(clamped / 100.f * seconds.size()));
+  return seconds[rank == 0 ? 0 : rank - 1];
+}
+
+size_t osrmc_startup_report_files(osrmc_startup_report_t report) { return report->files.size(); }
+
+const char* osrmc_startup_report_file_path(osrmc_startup_report_t report, size_t file) {
+  return report->files.at(file).path.c_str();
+}
+
+size_t osrmc_startup_report_file_bytes(osrmc_startup_report_t report, size_t file) {
+  return report->files.at(file).bytes;
+}
+
+size_t osrmc_startup_report_file_resident_bytes(osrmc_startup_report_t report, size_t file) {
+  return report->files.at(file).resident_bytes;
+}
+
+float osrmc_startup_report_file_seconds(osrmc_startup_report_t report, size_t file) {
+  return report->files.at(file).seconds;
+}
+
+/* Admission control */
+
+static double osrmc_cost(const osrm::RouteParameters& params) {
+  const auto legs = params.coordinates.size() > 1 ? params.coordinates.size() - 1 : 1;
+  return legs * (params.alternatives ? 2. : 1.);
+}
+
+static double osrmc_cost(const osrm::TableParameters& params) {
+  const auto count = params.coordinates.size();
+  const auto rows = params.sources.empty() ? count : params.sources.size();
+  const auto columns = params.destinations.empty() ? count : params.destinations.size();
+  return static_cast<double>(rows) * columns;
+}
+
+static double osrmc_cost(const osrm::NearestParameters& params) { return std::max(1u, params.number_of_results); }
+
+static double osrmc_cost(const osrm::MatchParameters& params) { return params.coordinates.size(); }
+
+// Holds an expensive-query slot for its lifetime; status tells whether the query was admitted.
+struct osrmc_admission_ticket final {
+  osrmc_admission_ticket(osrmc_admission& admission_, osrmc_service service_, double cost_,
+                         const osrmc_request& request)
+      : admission(admission_), service{service_}, cost{cost_}, started{std::chrono::steady_clock::now()} {
+    // Follow-up queries of one call (deduplication, isochrone batches) share its deadline
+    if (request.HasDeadline() && started >= request.deadline) {
+      status = OSRMC_ERROR_DEADLINE_EXCEEDED;
+      message = "Deadline passed before the query started";
+      return;
+    }
+
+    const auto max_expensive = admission.max_expensive.load();
+
+    // Cheap path: no locking at all
+    if (max_expensive == 0 || cost < admission.expensive_cost.load())
+      return;
+
+    std::unique_lock<std::mutex> lock{admission.mutex};
+
+    seconds = cost * admission.seconds_per_cost[service];
+
+    if (admission.running < max_expensive && admission.queue.empty()) {
+      Hold();
+      return;
+    }
+
+    if (admission.queue.size() >= admission.max_queue) {
+      status = OSRMC_ERROR_OVERLOADED;
+      message = "Too many expensive queries queued";
+      return;
+    }
+
+    const auto priority = request.priority;
+    const auto has_deadline = request.HasDeadline();
+    const auto deadline = request.deadline;
+
+    // Expected wait: work running or queued ahead of us, spread over all slots
+    if (has_deadline) {
+      auto ahead = admission.running_seconds;
+      for (const auto& waiter : admission.queue)
+        if (waiter.priority >= priority)
+          ahead += waiter.seconds;
+
+      const auto expected = std::chrono::duration<double>(ahead / max_expensive + seconds);
+      if (started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(expected) > deadline) {
+        status = OSRMC_ERROR_DEADLINE_EXCEEDED;
+        message = "Query can not complete before its deadline";
+        return;
+      }
+    }
+
+    const auto ticket = admission.next_ticket++;
+    admission.queue.push_back(osrmc_admission::Waiter{priority, ticket, seconds});
+
+    // Highest priority first, then arrival order
+    const auto first = [&] {
+      const auto best = std::min_element(admission.queue.begin(), admission.queue.end(),
+                                         [](const osrmc_admission::Waiter& lhs, const osrmc_admission::Waiter& rhs) {
+                                           return lhs.priority != rhs.priority ? lhs.priority > rhs.priority
+                                                                               : lhs.ticket < rhs.ticket;
+                                         });
+      return best->ticket == ticket;
+    };
+
+    // Admission control may be disabled meanwhile, which admits everyone waiting
+    const auto ready = [&] {
+      const auto limit = admission.max_expensive.load();
+      return limit == 0 || (admission.running < limit && first());
+    };
+
+    auto admitted = true;
+    if (has_deadline)
+      admitted = admission.released.wait_until(lock, deadline, ready);
+    else
+      admission.released.wait(lock, ready);
+
+    admission.queue.erase(std::find_if(admission.queue.begin(), admission.queue.end(),
+                                       [&](const osrmc_admission::Waiter& waiter) { return waiter.ticket == ticket; }));
+
+    // Whoever was behind us may be first now, with a slot still free
+    admission.released.notify_all();
+
+    if (!admitted) {
+      status = OSRMC_ERROR_DEADLINE_EXCEEDED;
+      message = "Deadline passed while queued";
+      return;
+    }
+
+    Hold();
+  }
+
+  ~osrmc_admission_ticket() {
+    if (!holding)
+      return;
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - held).count();
+
+    std::lock_guard<std::mutex> lock{admission.mutex};
+    admission.running -= 1;
+    admission.running_seconds -= seconds;
+
+    // Exponentially weighted moving average, only expensive queries matter for queueing estimates
+    if (cost > 0)
+      admission.seconds_per_cost[service] = 0.9 * admission.seconds_per_cost[service] + 0.1 * elapsed / cost;
+
+    admission.released.notify_all();
+  }
+
+  osrmc_admission_ticket(const osrmc_admission_ticket&) = delete;
+  osrmc_admission_ticket& operator=(const osrmc_admission_ticket&) = delete;
+
+  // Expects admission.mutex to be held.
+  void Hold() {
+    admission.running += 1;
+    admission.running_seconds += seconds;
+    holding = true;
+    held = std::chrono::steady_clock::now();
+  }
+
+  osrmc_admission& admission;
+  osrmc_service service;
+  double cost;
+  double seconds = 0.;
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point held; // queue time must not count towards the learned rate
+  bool holding = false;
+
+  osrmc_status_t status = OSRMC_OK;
+  const char* message = "";
+};
+
+void osrmc_osrm_set_admission(osrmc_osrm_t osrm, unsigned max_expensive, unsigned long expensive_cost,
+                              size_t max_queue) {
+  {
+    std::lock_guard<std::mutex> lock{osrm->admission.mutex};
+    osrm->admission.max_queue = max_queue;
+    osrm->admission.expensive_cost = static_cast<double>(expensive_cost);
+    osrm->admission.max_expensive = max_expensive;
+  }
+
+  osrm->admission.released.notify_all();
+}
+
+size_t osrmc_osrm_queue_depth(osrmc_osrm_t osrm) {
+  std::lock_guard<std::mutex> lock{osrm->admission.mutex};
+  return osrm->admission.queue.size();
+}
+
+size_t osrmc_osrm_running(osrmc_osrm_t osrm) {
+  std::lock_guard<std::mutex> lock{osrm->admission.mutex};
+  return osrm->admission.running;
+}
+
+/* Local query server */
+
+// Wire format: every frame is a header followed by length bytes of body, in host byte order.
+// Requests carry an osrmc_wire_kind, responses an osrmc_status_t; OSRMC_OK bodies depend on the request kind.
+// Coordinates travel as OSRM's int32 fixed-point values so that remote queries see exactly the local coordinates.
+// Frames are at most osrmc_wire_max_length bytes; larger responses are answered with OSRMC_ERROR_TOO_BIG.
+// Every request body starts with its scheduling options, which are not part of the deduplication key:
+//   Request prefix: uint32 milliseconds left until the deadline (zero means none); int32 priority
+//   Route request:  int32 from_lon, from_lat, to_lon, to_lat
+//   Route response: float duration, distance; per waypoint int32 lon, lat, uint32 name length, name
+//   Table request:  uint32 annotations, coordinates, sources, destinations; int32 lon, lat per coordinate;
+//                   uint32 per source; uint32 per destination
+//   Table response: uint32 annotations, rows, columns; float durations[rows * columns] if requested,
+//                   float distances[rows * columns] if requested; INFINITY marks unreachable cells
+//   Error response: message
+struct osrmc_wire_header final {
+  std::uint32_t length;
+  std::uint32_t id;
+  std::uint32_t kind;
+};
+
+enum osrmc_wire_kind : std::uint32_t { OSRMC_WIRE_ROUTE = 1, OSRMC_WIRE_TABLE = 2 };
+
+static const std::uint32_t osrmc_wire_max_length = 64u << 20;
+
+template <typename T>
+static void osrmc_wire_put(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T osrmc_wire_get(const std::string& in, std::size_t& offset) {
+  if (offset + sizeof(T) > in.size())
+    throw std::runtime_error("Truncated message");
+
+  T value;
+  std::memcpy(&value, in.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return value;
+}
+
+// Fails instead if the deadline already passed; remote deadlines are relative to the server's clock.
+static bool osrmc_wire_put_request(std::string& out, const osrmc_request& request) {
+  std::uint32_t remaining = 0;
+
+  if (request.HasDeadline()) {
+    const auto now = std::chrono::steady_clock::now();
+    if (request.deadline <= now)
+      return false;
+
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(request.deadline - now).count();
+    remaining = static_cast<std::uint32_t>(
+        std::min<long long>(std::max<long long>(1, left), std::numeric_limits<std::uint32_t>::max()));
+  }
+
+  osrmc_wire_put(out, remaining);
+  osrmc_wire_put(out, static_cast<std::int32_t>(request.priority));
+  return true;
+}
+
+static osrmc_request osrmc_wire_get_request(const std::string& in, std::size_t& offset) {
+  const auto remaining = osrmc_wire_get<std::uint32_t>(in, offset);
+  const auto priority = osrmc_wire_get<std::int32_t>(in, offset);
+  return osrmc_request{remaining, priority};
+}
+
+static std::string osrmc_wire_frame(std::uint32_t id, std::uint32_t kind, const std::string& body) {
+  std::string frame;
+  frame.reserve(sizeof(osrmc_wire_header) + body.size());
+  osrmc_wire_put(frame, osrmc_wire_header{static_cast<std::uint32_t>(body.size()), id, kind});
+  frame.append(body);
+  return frame;
+}
+
+static bool osrmc_wire_write(int fd, const std::string& frame) {
+  for (std::size_t sent = 0; sent < frame.size();) {
+    const auto n = ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+
+  return true;
+}
+
+static bool osrmc_wire_send(int fd, std::uint32_t id, std::uint32_t kind, const std::string& body) {
+  return osrmc_wire_write(fd, osrmc_wire_frame(id, kind, body));
+}
+
+static bool osrmc_wire_read(int fd, void* data, std::size_t size) {
+  auto* bytes = static_cast<char*>(data);
+
+  for (std::size_t received = 0; received < size;) {
+    const auto n = ::recv(fd, bytes + received, size - received, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    received += n;
+  }
+
+  return true;
+}
+
+static bool osrmc_wire_receive(int fd, osrmc_wire_header& header, std::string& body) {
+  if (!osrmc_wire_read(fd, &header, sizeof(header)) || header.length > osrmc_wire_max_length)
+    return false;
+
+  body.resize(header.length);
+  return osrmc_wire_read(fd, &body[0], body.size());
+}
+
+static int osrmc_unix_socket(const std::string& path, sockaddr_un& address) {
+  if (path.size() >= sizeof(address.sun_path))
+    throw std::invalid_argument("Socket path too long");
+
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    throw std::runtime_error(std::string{"Unable to create socket: "} + std::strerror(errno));
+
+  return fd;
+}
+
+static void osrmc_json_error(osrm::json::Object& result, osrmc_status_t status, const std::string& message) {
+  result.values["code"] = osrm::json::String{osrmc_status_code(status)};
+  result.values["message"] = osrm::json::String{message};
+}
+
+static std::string osrmc_json_message(osrm::json::Object& result) {
+  const auto found = result.values.find("message");
+  if (found == result.values.end() || !found->second.is<osrm::json::String>())
+    return "Unknown error";
+  return found->second.get<osrm::json::String>().value;
+}
+
+static osrmc_status_t osrmc_json_status(osrm::json::Object& result) {
+  const auto found = result.values.find("code");
+  if (found == result.values.end() || !found->second.is<osrm::json::String>())
+    return OSRMC_ERROR_UNKNOWN;
+  return osrmc_status_from_code(found->second.get<osrm::json::String>().value);
+}
+
+// Client side of a server connection. Requests from many threads are pipelined over one socket:
+// whichever waiting thread is not blocked on another's response reads the next frame and hands it over by id.
+struct osrmc_client final {
+  explicit osrmc_client(int fd_) : fd{fd_} {}
+  ~osrmc_client() { ::close(fd); }
+
+  std::string Request(std::uint32_t kind, const std::string& body, std::uint32_t& status);
+
+  int fd;
+  std::atomic<std::uint32_t> next_id{0};
+
+  std::mutex write;
+
+  std::mutex read;
+  std::condition_variable arrived;
+  bool reading = false;
+  bool broken = false;
+  std::unordered_map<std::uint32_t, std::pair<std::uint32_t, std::string>> responses;
+};
+
+std::string osrmc_client::Request(std::uint32_t kind, const std::string& body, std::uint32_t& status) {
+  // The server would drop the connection on an oversized frame
+  if (body.size() > osrmc_wire_max_length) {
+    status = OSRMC_ERROR_TOO_BIG;
+    return "Request exceeds the maximum frame size";
+  }
+
+  const auto id = next_id++;
+
+  {
+    std::lock_guard<std::mutex> lock{write};
+    if (!osrmc_wire_send(fd, id, kind, body))
+      throw std::runtime_error("Unable to send request to server");
+  }
+
+  std::unique_lock<std::mutex> lock{read};
+
+  for (;;) {
+    const auto found = responses.find(id);
+    if (found != responses.end()) {
+      status = found->second.first;
+      auto response = std::move(found->second.second);
+      responses.erase(found);
+      return response;
+    }
+
+    if (broken)
+      throw std::runtime_error("Connection to server lost");
+
+    if (reading) {
+      arrived.wait(lock);
+      continue;
+    }
+
+    reading = true;
+    lock.unlock();
+
+    osrmc_wire_header header;
+    std::string response;
+    const auto received = osrmc_wire_receive(fd, header, response);
+
+    lock.lock();
+    reading = false;
+
+    if (received)
+      responses[header.id] = std::make_pair(header.kind, std::move(response));
+    else
+      broken = true;
+
+    arrived.notify_all();
+  }
+}
+
+osrmc_osrm::osrmc_osrm() = default;
+osrmc_osrm::~osrmc_osrm() = default;
+
+osrm::Status osrmc_osrm::Route(const osrm::RouteParameters& params, osrm::json::Object& result,
+                              const osrmc_request& request) {
+  osrmc_admission_ticket ticket{admission, OSRMC_SERVICE_ROUTE, osrmc_cost(params), request};
+  if (ticket.status != OSRMC_OK) {
+    osrmc_json_error(result, ticket.status, ticket.message);
+    return osrm::Status::Error;
+  }
+
+  if (engine) {
+    const auto status = engine->Route(params, result);
+    Served();
+    return status;
+  }
+
+  // Two-point summaries only: the server coalesces these into batched Table requests
+  if (params.coordinates.size() != 2 || params.steps || params.alternatives || params.annotations ||
+      !params.bearings.empty() || !params.radiuses.empty() || !params.hints.empty()) {
+    osrmc_json_error(result, OSRMC_ERROR_NOT_IMPLEMENTED, "Remote Route supports two plain coordinates only");
+    return osrm::Status::Error;
+  }
+
+  std::string body;
+  if (!osrmc_wire_put_request(body, request)) {
+    osrmc_json_error(result, OSRMC_ERROR_DEADLINE_EXCEEDED, "Deadline passed before sending the query");
+    return osrm::Status::Error;
+  }
+
+  for (const auto& coordinate : params.coordinates) {
+    osrmc_wire_put(body, static_cast<std::int32_t>(coordinate.lon));
+    osrmc_wire_put(body, static_cast<std::int32_t>(coordinate.lat));
+  }
+
+  std::uint32_t status;
+  const auto response = client->Request(OSRMC_WIRE_ROUTE, body, status);
+
+  if (status != OSRMC_OK) {
+    osrmc_json_error(result, static_cast<osrmc_status_t>(status), response);
+    return osrm::Status::Error;
+  }
+
+  std::size_t offset = 0;
+  const auto duration = osrmc_wire_get<float>(response, offset);
+  const auto distance = osrmc_wire_get<float>(response, offset);
+
+  osrm::json::Object route;
+  route.values["duration"] = osrm::json::Number{duration};
+  route.values["distance"] = osrm::json::Number{distance};
+
+  osrm::json::Array routes;
+  routes.values.emplace_back(std::move(route));
+
+  osrm::json::Array waypoints;
+  for (std::size_t i = 0; i < params.coordinates.size(); ++i) {
+    const auto longitude = osrmc_wire_get<std::int32_t>(response, offset);
+    const auto latitude = osrmc_wire_get<std::int32_t>(response, offset);
+    const auto length = osrmc_wire_get<std::uint32_t>(response, offset);
+
+    if (offset + length > response.size())
+      throw std::runtime_error("Truncated message");
+
+    osrm::json::Array location;
+    location.values.emplace_back(osrm::json::Number{static_cast<double>(osrm::util::toFloating(osrm::util::FixedLongitude{longitude}))});
+    location.values.emplace_back(osrm::json::Number{static_cast<double>(osrm::util::toFloating(osrm::util::FixedLatitude{latitude}))});
+
+    osrm::json::Object waypoint;
+    waypoint.values["name"] = osrm::json::String{response.substr(offset, length)};
+    waypoint.values["location"] = std::move(location);
+    offset += length;
+
+    waypoints.values.emplace_back(std::move(waypoint));
+  }
+
+  result.values["code"] = osrm::json::String{"Ok"};
+  result.values["routes"] = std::move(routes);
+  result.values["waypoints"] = std::move(waypoints);
+  return osrm::Status::Ok;
+}
+
+osrm::Status osrmc_osrm::Table(const osrm::TableParameters& params, osrm::json::Object& result,
+                              const osrmc_request& request) {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  osrmc_admission_ticket ticket{admission, OSRMC_SERVICE_TABLE, osrmc_cost(params), request};
+  if (ticket.status != OSRMC_OK) {
+    osrmc_json_error(result, ticket.status, ticket.message);
+    return osrm::Status::Error;
+  }
+
+  if (engine) {
+    const auto status = engine->Table(params, result);
+    Served();
+    return status;
+  }
+
+  if (!params.bearings.empty() || !params.radiuses.empty() || !params.hints.empty()) {
+    osrmc_json_error(result, OSRMC_ERROR_NOT_IMPLEMENTED, "Remote Table does not support bearings, radiuses or hints");
+    return osrm::Status::Error;
+  }
+
+  std::string body;
+  if (!osrmc_wire_put_request(body, request)) {
+    osrmc_json_error(result, OSRMC_ERROR_DEADLINE_EXCEEDED, "Deadline passed before sending the query");
+    return osrm::Status::Error;
+  }
+
+  osrmc_wire_put(body, static_cast<std::uint32_t>(params.annotations));
+  osrmc_wire_put(body, static_cast<std::uint32_t>(params.coordinates.size()));
+  osrmc_wire_put(body, static_cast<std::uint32_t>(params.sources.size()));
+  osrmc_wire_put(body, static_cast<std::uint32_t>(params.destinations.size()));
+
+  for (const auto& coordinate : params.coordinates) {
+    osrmc_wire_put(body, static_cast<std::int32_t>(coordinate.lon));
+    osrmc_wire_put(body, static_cast<std::int32_t>(coordinate.lat));
+  }
+  for (const auto source : params.sources)
+    osrmc_wire_put(body, static_cast<std::uint32_t>(source));
+  for (const auto destination : params.destinations)
+    osrmc_wire_put(body, static_cast<std::uint32_t>(destination));
+
+  std::uint32_t status;
+  const auto response = client->Request(OSRMC_WIRE_TABLE, body, status);
+
+  if (status != OSRMC_OK) {
+    osrmc_json_error(result, static_cast<osrmc_status_t>(status), response);
+    return osrm::Status::Error;
+  }
+
+  std::size_t offset = 0;
+  const auto annotations = static_cast<AnnotationsType>(osrmc_wire_get<std::uint32_t>(response, offset));
+  const auto rows = osrmc_wire_get<std::uint32_t>(response, offset);
+  const auto columns = osrmc_wire_get<std::uint32_t>(response, offset);
+
+  const auto read_table = [&](const char* key) {
+    osrm::json::Array table;
+    table.values.reserve(rows);
+
+    for (std::uint32_t row = 0; row < rows; ++row) {
+      osrm::json::Array cells;
+      cells.values.reserve(columns);
+
+      for (std::uint32_t column = 0; column < columns; ++column) {
+        const auto value = osrmc_wire_get<float>(response, offset);
+        if (std::isinf(value))
+          cells.values.emplace_back(osrm::json::Null{});
+        else
+          cells.values.emplace_back(osrm::json::Number{value});
+      }
+
+      table.values.emplace_back(std::move(cells));
+    }
+
+    result.values[key] = std::move(table);
+  };
+
+  if (osrmc_table_annotations_has(annotations, AnnotationsType::Duration))
+    read_table("durations");
+  if (osrmc_table_annotations_has(annotations, AnnotationsType::Distance))
+    read_table("distances");
+
+  result.values["code"] = osrm::json::String{"Ok"};
+  return osrm::Status::Ok;
+}
+
+osrm::Status osrmc_osrm::Nearest(const osrm::NearestParameters& params, osrm::json::Object& result,
+                              const osrmc_request& request) {
+  osrmc_admission_ticket ticket{admission, OSRMC_SERVICE_NEAREST, osrmc_cost(params), request};
+  if (ticket.status != OSRMC_OK) {
+    osrmc_json_error(result, ticket.status, ticket.message);
+    return osrm::Status::Error;
+  }
+
+  if (engine) {
+    const auto status = engine->Nearest(params, result);
+    Served();
+    return status;
+  }
+
+  osrmc_json_error(result, OSRMC_ERROR_NOT_IMPLEMENTED, "Nearest is not available over a server connection");
+  return osrm::Status::Error;
+}
+
+osrm::Status osrmc_osrm::Match(const osrm::MatchParameters& params, osrm::json::Object& result,
+                              const osrmc_request& request) {
+  osrmc_admission_ticket ticket{admission, OSRMC_SERVICE_MATCH, osrmc_cost(params), request};
+  if (ticket.status != OSRMC_OK) {
+    osrmc_json_error(result, ticket.status, ticket.message);
+    return osrm::Status::Error;
+  }
+
+  if (engine) {
+    const auto status = engine->Match(params, result);
+    Served();
+    return status;
+  }
+
+  osrmc_json_error(result, OSRMC_ERROR_NOT_IMPLEMENTED, "Match is not available over a server connection");
+  return osrm::Status::Error;
+}
+
+osrmc_osrm_t osrmc_osrm_connect(const char* socket_path, osrmc_error_t* error) try {
+  sockaddr_un address;
+  const auto fd = osrmc_unix_socket(socket_path, address);
+
+  std::unique_ptr<osrmc_osrm> out{new osrmc_osrm};
+  out->client.reset(new osrmc_client{fd});
+
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    throw std::runtime_error(std::string{"Unable to connect to "} + socket_path + ": " + std::strerror(errno));
+
+  out->constructed = std::chrono::steady_clock::now();
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+struct osrmc_server_client final {
+  explicit osrmc_server_client(int fd_) : fd{fd_} {}
+  ~osrmc_server_client() { ::close(fd); }
+
+  // Queues a response for Write and never blocks, so that a client which stops reading its responses can not
+  // stall the workers. Too many unread responses drop the connection instead.
+  void Send(std::uint32_t id, std::uint32_t kind, const std::string& body) {
+    auto frame = osrmc_wire_frame(id, kind, body);
+
+    std::lock_guard<std::mutex> lock{mutex};
+    if (closed)
+      return;
+
+    if (queued + frame.size() > 4 * std::size_t{osrmc_wire_max_length}) {
+      Disconnect();
+      return;
+    }
+
+    queued += frame.size();
+    outbox.emplace_back(std::move(frame));
+    ready.notify_one();
+  }
+
+  // Runs on the client's writer thread until Close or a failed send.
+  void Write() {
+    std::unique_lock<std::mutex> lock{mutex};
+
+    for (;;) {
+      ready.wait(lock, [&] { return closed || !outbox.empty(); });
+      if (closed)
+        return;
+
+      const auto frame = std::move(outbox.front());
+      outbox.pop_front();
+      queued -= frame.size();
+
+      lock.unlock();
+      const auto sent = osrmc_wire_write(fd, frame);
+      lock.lock();
+
+      if (!sent) {
+        Disconnect();
+        return;
+      }
+    }
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock{mutex};
+    Disconnect();
+  }
+
+  // Expects mutex to be held. Also wakes a writer blocked in send and ends the reader.
+  void Disconnect() {
+    closed = true;
+    outbox.clear();
+    queued = 0;
+    ::shutdown(fd, SHUT_RDWR);
+    ready.notify_all();
+  }
+
+  int fd;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::string> outbox;
+  std::size_t queued = 0;
+  bool closed = false;
+};
+
+struct osrmc_server_waiter final {
+  std::shared_ptr<osrmc_server_client> client;
+  std::uint32_t id;
+  osrmc_request request;
+};
+
+struct osrmc_server final {
+  osrmc_osrm* osrm;
+  std::string path;
+  int listener;
+  unsigned threads;
+
+  std::size_t max_batch = 64;
+  std::chrono::microseconds window{500};
+
+  std::mutex mutex;
+  bool stopping = false;
+
+  // Queries keyed by kind and request body; identical in-flight queries share one computation
+  std::unordered_map<std::string, std::vector<osrmc_server_waiter>> in_flight;
+
+  std::vector<std::string> batch;
+  std::chrono::steady_clock::time_point batch_started;
+  std::condition_variable batch_ready;
+
+  std::deque<std::function<void()>> jobs;
+  std::condition_variable jobs_ready;
+
+  std::vector<std::shared_ptr<osrmc_server_client>> clients;
+  std::size_t readers = 0;
+  std::condition_variable readers_done;
+};
+
+static void osrmc_server_complete(osrmc_server& server, const std::string& key, std::uint32_t status,
+                                  const std::string& body) {
+  // Clients reject oversized frames and could not resynchronize their connection
+  if (body.size() > osrmc_wire_max_length) {
+    osrmc_server_complete(server, key, OSRMC_ERROR_TOO_BIG, "Response exceeds the maximum frame size");
+    return;
+  }
+
+  std::vector<osrmc_server_waiter> waiters;
+
+  {
+    std::lock_guard<std::mutex> lock{server.mutex};
+    const auto found = server.in_flight.find(key);
+    if (found == server.in_flight.end())
+      return;
+    waiters = std::move(found->second);
+    server.in_flight.erase(found);
+  }
+
+  for (const auto& waiter : waiters)
+    waiter.client->Send(waiter.id, status, body);
+}
+
+// Scheduling options for a computation shared by all waiters of the given queries: the most lenient of theirs,
+// so that sharing never fails a query earlier than it would have failed on its own.
+static osrmc_request osrmc_server_request(osrmc_server& server, const std::vector<std::string>& keys) {
+  osrmc_request merged;
+  auto first = true;
+
+  std::lock_guard<std::mutex> lock{server.mutex};
+
+  for (const auto& key : keys) {
+    const auto found = server.in_flight.find(key);
+    if (found == server.in_flight.end())
+      continue;
+
+    for (const auto& waiter : found->second) {
+      if (first) {
+        merged = waiter.request;
+        first = false;
+        continue;
+      }
+
+      merged.priority = std::max(merged.priority, waiter.request.priority);
+
+      if (!merged.HasDeadline() || !waiter.request.HasDeadline())
+        merged.deadline = {};
+      else
+        merged.deadline = std::max(merged.deadline, waiter.request.deadline);
+    }
+  }
+
+  return merged;
+}
+
+static void osrmc_server_route_batch(osrmc_server& server, const std::vector<std::string>& keys);
+
+// A single bad query (e.g. an unsnappable coordinate) fails the whole batched Table request. Bisects the batch
+// so that only the failing queries see the error; handle-wide conditions are reported to everyone right away.
+static void osrmc_server_route_retry(osrmc_server& server, const std::vector<std::string>& keys,
+                                     osrmc_status_t status, const std::string& message) {
+  if (keys.size() == 1 || status == OSRMC_ERROR_OVERLOADED || status == OSRMC_ERROR_DEADLINE_EXCEEDED) {
+    for (const auto& key : keys)
+      osrmc_server_complete(server, key, status, message);
+    return;
+  }
+
+  const auto middle = keys.begin() + keys.size() / 2;
+  osrmc_server_route_batch(server, {keys.begin(), middle});
+  osrmc_server_route_batch(server, {middle, keys.end()});
+}
+
+// Answers a batch of two-point queries with a single Table request over their distinct endpoints.
+static void osrmc_server_route_batch(osrmc_server& server, const std::vector<std::string>& keys) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  osrm::TableParameters params;
+  params.annotations = AnnotationsType::Duration;
+  params.annotations |= AnnotationsType::Distance;
+
+  std::vector<osrm::util::Coordinate> source_coordinates, destination_coordinates;
+  std::unordered_map<std::uint64_t, std::size_t> sources, destinations;
+
+  const auto packed = [](std::int32_t longitude, std::int32_t latitude) {
+    return static_cast<std::uint64_t>(static_cast<std::uint32_t>(longitude)) << 32 |
+           static_cast<std::uint32_t>(latitude);
+  };
+
+  std::vector<std::pair<std::size_t, std::size_t>> pairs;
+
+  for (const auto& key : keys) {
+    std::size_t offset = sizeof(std::uint32_t);
+    const auto from_lon = osrmc_wire_get<std::int32_t>(key, offset);
+    const auto from_lat = osrmc_wire_get<std::int32_t>(key, offset);
+    const auto to_lon = osrmc_wire_get<std::int32_t>(key, offset);
+    const auto to_lat = osrmc_wire_get<std::int32_t>(key, offset);
+
+    const auto source = sources.emplace(packed(from_lon, from_lat), sources.size());
+    if (source.second)
+      source_coordinates.emplace_back(osrm::util::FixedLongitude{from_lon}, osrm::util::FixedLatitude{from_lat});
+
+    const auto destination = destinations.emplace(packed(to_lon, to_lat), destinations.size());
+    if (destination.second)
+      destination_coordinates.emplace_back(osrm::util::FixedLongitude{to_lon}, osrm::util::FixedLatitude{to_lat});
+
+    pairs.emplace_back(source.first->second, destination.first->second);
+  }
+
+  params.coordinates = source_coordinates;
+  params.coordinates.insert(params.coordinates.end(), destination_coordinates.begin(), destination_coordinates.end());
+
+  for (std::size_t i = 0; i < source_coordinates.size(); ++i)
+    params.sources.emplace_back(i);
+  for (std::size_t i = 0; i < destination_coordinates.size(); ++i)
+    params.destinations.emplace_back(source_coordinates.size() + i);
+
+  osrm::json::Object result;
+  if (server.osrm->Table(params, result, osrmc_server_request(server, keys)) != osrm::Status::Ok) {
+    osrmc_server_route_retry(server, keys, osrmc_json_status(result), osrmc_json_message(result));
+    return;
+  }
+
+  const auto columns = destination_coordinates.size();
+  const auto durations = osrmc_table_extract(result, "durations", source_coordinates.size(), columns);
+  const auto distances = osrmc_table_extract(result, "distances", source_coordinates.size(), columns);
+
+  // Snapped location and name from the Table's sources or destinations, the query coordinate if it has none
+  const auto put_waypoint = [&](std::string& body, const char* key, std::size_t index,
+                                const osrm::util::Coordinate& coordinate) {
+    auto longitude = static_cast<std::int32_t>(coordinate.lon);
+    auto latitude = static_cast<std::int32_t>(coordinate.lat);
+    std::string name;
+
+    const auto found = result.values.find(key);
+    if (found != result.values.end()) {
+      const auto& waypoint = found->second.get<osrm::json::Array>().values.at(index).get<osrm::json::Object>();
+      const auto& location = waypoint.values.at("location").get<osrm::json::Array>().values;
+
+      const osrm::util::Coordinate snapped{
+          osrm::util::FloatLongitude{location.at(0).get<osrm::json::Number>().value},
+          osrm::util::FloatLatitude{location.at(1).get<osrm::json::Number>().value}};
+      longitude = static_cast<std::int32_t>(snapped.lon);
+      latitude = static_cast<std::int32_t>(snapped.lat);
+      name = waypoint.values.at("name").get<osrm::json::String>().value;
+    }
+
+    osrmc_wire_put(body, longitude);
+    osrmc_wire_put(body, latitude);
+    osrmc_wire_put(body, static_cast<std::uint32_t>(name.size()));
+    body.append(name);
+  };
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const auto cell = pairs[i].first * columns + pairs[i].second;
+
+    if (std::isinf(durations[cell])) {
+      osrmc_server_complete(server, keys[i], OSRMC_ERROR_NO_ROUTE, "Impossible route between points");
+      continue;
+    }
+
+    std::string body;
+    osrmc_wire_put(body, durations[cell]);
+    osrmc_wire_put(body, distances[cell]);
+    put_waypoint(body, "sources", pairs[i].first, source_coordinates[pairs[i].first]);
+    put_waypoint(body, "destinations", pairs[i].second, destination_coordinates[pairs[i].second]);
+    osrmc_server_complete(server, keys[i], OSRMC_OK, body);
+  }
+} catch (const std::exception& e) {
+  osrmc_server_route_retry(server, keys, OSRMC_ERROR_EXCEPTION, e.what());
+}
+
+static void osrmc_server_table(osrmc_server& server, const std::string& key) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  std::size_t offset = sizeof(std::uint32_t);
+
+  osrm::TableParameters params;
+  params.annotations = static_cast<AnnotationsType>(osrmc_wire_get<std::uint32_t>(key, offset));
+
+  const auto count = osrmc_wire_get<std::uint32_t>(key, offset);
+  const auto source_count = osrmc_wire_get<std::uint32_t>(key, offset);
+  const auto destination_count = osrmc_wire_get<std::uint32_t>(key, offset);
+
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const auto longitude = osrmc_wire_get<std::int32_t>(key, offset);
+    const auto latitude = osrmc_wire_get<std::int32_t>(key, offset);
+    params.coordinates.emplace_back(osrm::util::FixedLongitude{longitude}, osrm::util::FixedLatitude{latitude});
+  }
+  for (std::uint32_t i = 0; i < source_count; ++i)
+    params.sources.emplace_back(osrmc_wire_get<std::uint32_t>(key, offset));
+  for (std::uint32_t i = 0; i < destination_count; ++i)
+    params.destinations.emplace_back(osrmc_wire_get<std::uint32_t>(key, offset));
+
+  const auto rows = source_count > 0 ? source_count : count;
+  const auto columns = destination_count > 0 ? destination_count : count;
+
+  // Refuse before computing a response the client could not receive
+  const auto tables = osrmc_table_annotations_has(params.annotations, AnnotationsType::Duration) +
+                      osrmc_table_annotations_has(params.annotations, AnnotationsType::Distance);
+  if (3 * sizeof(std::uint32_t) + static_cast<double>(rows) * columns * tables * sizeof(float) >
+      osrmc_wire_max_length) {
+    osrmc_server_complete(server, key, OSRMC_ERROR_TOO_BIG, "Response exceeds the maximum frame size");
+    return;
+  }
+
+  osrm::json::Object result;
+  if (server.osrm->Table(params, result, osrmc_server_request(server, {key})) != osrm::Status::Ok) {
+    osrmc_server_complete(server, key, osrmc_json_status(result), osrmc_json_message(result));
+    return;
+  }
+
+  std::string body;
+  osrmc_wire_put(body, static_cast<std::uint32_t>(params.annotations));
+  osrmc_wire_put(body, rows);
+  osrmc_wire_put(body, columns);
+
+  if (osrmc_table_annotations_has(params.annotations, AnnotationsType::Duration))
+    for (const auto value : osrmc_table_extract(result, "durations", rows, columns))
+      osrmc_wire_put(body, value);
+
+  if (osrmc_table_annotations_has(params.annotations, AnnotationsType::Distance))
+    for (const auto value : osrmc_table_extract(result, "distances", rows, columns))
+      osrmc_wire_put(body, value);
+
+  osrmc_server_complete(server, key, OSRMC_OK, body);
+} catch (const std::exception& e) {
+  osrmc_server_complete(server, key, OSRMC_ERROR_EXCEPTION, e.what());
+}
+
+// Expects server.mutex to be held.
+static void osrmc_server_flush(osrmc_server& server) {
+  if (server.batch.empty())
+    return;
+
+  auto keys = std::make_shared<std::vector<std::string>>(std::move(server.batch));
+  server.batch.clear();
+
+  server.jobs.emplace_back([&server, keys] { osrmc_server_route_batch(server, *keys); });
+  server.jobs_ready.notify_one();
+}
+
+static void osrmc_server_submit(osrmc_server& server, const std::shared_ptr<osrmc_server_client>& client,
+                                const osrmc_wire_header& header, const std::string& body) {
+  if (header.kind != OSRMC_WIRE_ROUTE && header.kind != OSRMC_WIRE_TABLE) {
+    client->Send(header.id, OSRMC_ERROR_INVALID_SERVICE, "Unknown request kind");
+    return;
+  }
+
+  if (body.size() < sizeof(std::uint32_t) + sizeof(std::int32_t)) {
+    client->Send(header.id, OSRMC_ERROR_INVALID_QUERY, "Truncated message");
+    return;
+  }
+
+  std::size_t offset = 0;
+  const auto request = osrmc_wire_get_request(body, offset);
+
+  std::string key;
+  key.reserve(sizeof(header.kind) + body.size() - offset);
+  osrmc_wire_put(key, header.kind);
+  key.append(body, offset, std::string::npos);
+
+  std::lock_guard<std::mutex> lock{server.mutex};
+
+  auto& waiters = server.in_flight[key];
+  waiters.push_back(osrmc_server_waiter{client, header.id, request});
+
+  if (waiters.size() > 1)
+    return;
+
+  if (header.kind == OSRMC_WIRE_TABLE) {
+    server.jobs.emplace_back([&server, key] { osrmc_server_table(server, key); });
+    server.jobs_ready.notify_one();
+    return;
+  }
+
+  if (server.batch.empty()) {
+    server.batch_started = std::chrono::steady_clock::now();
+    server.batch_ready.notify_one();
+  }
+
+  server.batch.push_back(std::move(key));
+
+  if (server.batch.size() >= server.max_batch)
+    osrmc_server_flush(server);
+}
+
+static void osrmc_server_worker(osrmc_server& server) {
+  for (;;) {
+    std::function<void()> job;
+
+    {
+      std::unique_lock<std::mutex> lock{server.mutex};
+      server.jobs_ready.wait(lock, [&] { return server.stopping || !server.jobs.empty(); });
+
+      if (server.jobs.empty())
+        return;
+
+      job = std::move(server.jobs.front());
+      server.jobs.pop_front();
+    }
+
+    job();
+  }
+}
+
+// Flushes the pending two-point batch once its coalescing window elapsed.
+static void osrmc_server_batcher(osrmc_server& server) {
+  std::unique_lock<std::mutex> lock{server.mutex};
+
+  for (;;) {
+    server.batch_ready.wait(lock, [&] { return server.stopping || !server.batch.empty(); });
+
+    if (server.stopping) {
+      osrmc_server_flush(server);
+      return;
+    }
+
+    // A batch flushed early for being full may have been replaced by a younger one meanwhile
+    while (!server.stopping && !server.batch.empty() &&
+           std::chrono::steady_clock::now() < server.batch_started + server.window)
+      server.batch_ready.wait_until(lock, server.batch_started + server.window);
+
+    osrmc_server_flush(server);
+  }
+}
+
+static void osrmc_server_reader(osrmc_server& server, std::shared_ptr<osrmc_server_client> client) {
+  std::thread writer;
+  try {
+    writer = std::thread{&osrmc_server_client::Write, client.get()};
+  } catch (const std::exception&) {
+    // Without a writer the client could never receive anything
+  }
+
+  osrmc_wire_header header;
+  std::string body;
+
+  while (writer.joinable() && osrmc_wire_receive(client->fd, header, body))
+    osrmc_server_submit(server, client, header, body);
+
+  client->Close();
+  if (writer.joinable())
+    writer.join();
+
+  std::lock_guard<std::mutex> lock{server.mutex};
+  server.clients.erase(std::find(server.clients.begin(), server.clients.end(), client));
+  server.readers -= 1;
+  server.readers_done.notify_all();
+}
+
+osrmc_server_t osrmc_server_construct(osrmc_osrm_t osrm, const char* socket_path, unsigned threads,
+                                      osrmc_error_t* error) try {
+  if (!osrm->engine)
+    throw std::invalid_argument("Server requires a handle with a local dataset");
+
+  sockaddr_un address;
+  const auto fd = osrmc_unix_socket(socket_path, address);
+
+  std::unique_ptr<osrmc_server> out{new osrmc_server};
+  out->osrm = osrm;
+  out->path = socket_path;
+  out->listener = fd;
+  out->threads = std::max(1u, threads);
+
+  // Replace a stale socket from an earlier run, but never anything else
+  struct stat existing;
+  if (::lstat(socket_path, &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      ::close(fd);
+      throw std::invalid_argument(std::string{socket_path} + " exists and is not a socket");
+    }
+    ::unlink(socket_path);
+  }
+
+  // Owner only; nobody can connect before listen, so there is no window with the umask's permissions
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::chmod(socket_path, 0600) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    const auto reason = std::string{"Unable to listen on "} + socket_path + ": " + std::strerror(errno);
+    ::close(fd);
+    throw std::runtime_error(reason);
+  }
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_server_destruct(osrmc_server_t server) {
+  ::close(server->listener);
+  ::unlink(server->path.c_str());
+  delete server;
+}
+
+void osrmc_server_set_batching(osrmc_server_t server, unsigned max_batch, unsigned window_us) {
+  std::lock_guard<std::mutex> lock{server->mutex};
+  server->max_batch = std::max(1u, max_batch);
+  server->window = std::chrono::microseconds{window_us};
+}
+
+// Stops the server and joins its threads on every exit from osrmc_server_run, exceptions included:
+// destroying a joinable std::thread would terminate the process.
+struct osrmc_server_threads final {
+  explicit osrmc_server_threads(osrmc_server& server_) : server(server_) {}
+
+  ~osrmc_server_threads() {
+    {
+      std::unique_lock<std::mutex> lock{server.mutex};
+      server.stopping = true;
+
+      // Ends readers and writers alike, also writers blocked on clients that stopped reading
+      for (const auto& client : server.clients)
+        ::shutdown(client->fd, SHUT_RDWR);
+
+      server.readers_done.wait(lock, [&] { return server.readers == 0; });
+    }
+
+    server.batch_ready.notify_all();
+    if (batcher.joinable())
+      batcher.join();
+
+    server.jobs_ready.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  osrmc_server_threads(const osrmc_server_threads&) = delete;
+  osrmc_server_threads& operator=(const osrmc_server_threads&) = delete;
+
+  osrmc_server& server;
+  std::vector<std::thread> workers;
+  std::thread batcher;
+};
+
+void osrmc_server_run(osrmc_server_t server, osrmc_error_t* error) try {
+  osrmc_server_threads threads{*server};
+
+  for (unsigned i = 0; i < server->threads; ++i)
+    threads.workers.emplace_back(osrmc_server_worker, std::ref(*server));
+
+  threads.batcher = std::thread{osrmc_server_batcher, std::ref(*server)};
+
+  for (;;) {
+    const auto fd = ::accept4(server->listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock{server->mutex};
+    if (server->stopping) {
+      ::close(fd);
+      break;
+    }
+
+    std::shared_ptr<osrmc_server_client> client;
+    try {
+      client = std::make_shared<osrmc_server_client>(fd);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+
+    server->clients.push_back(client);
+    try {
+      std::thread{osrmc_server_reader, std::ref(*server), client}.detach();
+    } catch (...) {
+      server->clients.pop_back();
+      throw;
+    }
+    server->readers += 1;
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_server_stop(osrmc_server_t server) {
+  {
+    std::lock_guard<std::mutex> lock{server->mutex};
+    server->stopping = true;
+  }
+
+  ::shutdown(server->listener, SHUT_RDWR);
+}
+
 struct JSONObject {
     explicit JSONObject(PyObject **out) : ret(out) {}
 
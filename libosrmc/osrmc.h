@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifndef OSRMC_H_
 #define OSRMC_H_
@@ -80,6 +81,28 @@
  *     return EXIT_FAILURE;
  *   }
  *
+ * Alternatively pass NULL instead of an osrmc_error_t out parameter. No error object gets allocated then;
+ * on failure the library records a numeric osrmc_status_t and a message in thread-local storage instead.
+ * This is cheap enough for expected conditions such as unreachable cells in a Table response.
+ *
+ * Example:
+ *
+ *   duration = osrmc_table_response_duration(response, from, to, NULL);
+ *   if (duration == INFINITY && osrmc_last_status() != OSRMC_ERROR_NO_ROUTE) {
+ *     fprintf(stderr, "Error: %s\n", osrmc_last_message());
+ *   }
+ *
+ * Successful calls leave the thread's status untouched. For functions without a failure return value (e.g. the
+ * void setters) clear the status first and check it afterwards.
+ *
+ * Example:
+ *
+ *   osrmc_clear_status();
+ *   osrmc_params_add_coordinate(params, longitude, latitude, NULL);
+ *   if (osrmc_last_status() != OSRMC_OK) {
+ *     fprintf(stderr, "Error: %s\n", osrmc_last_message());
+ *   }
+ *
  *
  * Responses and Callbacks
  * =======================
@@ -122,8 +145,8 @@ extern "C" {
   #define OSRMC_API
 #endif
 
-#define OSRMC_VERSION_MAJOR 5
-#define OSRMC_VERSION_MINOR 3
+#define OSRMC_VERSION_MAJOR 6
+#define OSRMC_VERSION_MINOR 0
 #define OSRMC_VERSION ((OSRMC_VERSION_MAJOR << 16) | OSRMC_VERSION_MINOR)
 
 OSRMC_API unsigned osrmc_get_version(void);
@@ -133,6 +156,28 @@ OSRMC_API int osrmc_is_abi_compatible(void);
 
 typedef struct osrmc_error* osrmc_error_t;
 
+// Stable numeric error codes; new codes are only ever appended.
+typedef enum {
+  OSRMC_OK = 0,
+  OSRMC_ERROR_EXCEPTION = 1,
+  OSRMC_ERROR_UNKNOWN = 2,
+  OSRMC_ERROR_INVALID_URL = 3,
+  OSRMC_ERROR_INVALID_SERVICE = 4,
+  OSRMC_ERROR_INVALID_VERSION = 5,
+  OSRMC_ERROR_INVALID_OPTIONS = 6,
+  OSRMC_ERROR_INVALID_QUERY = 7,
+  OSRMC_ERROR_INVALID_VALUE = 8,
+  OSRMC_ERROR_NO_SEGMENT = 9,
+  OSRMC_ERROR_TOO_BIG = 10,
+  OSRMC_ERROR_NO_ROUTE = 11,
+  OSRMC_ERROR_NO_TABLE = 12,
+  OSRMC_ERROR_NO_MATCH = 13,
+  OSRMC_ERROR_NO_TRIPS = 14,
+  OSRMC_ERROR_NOT_IMPLEMENTED = 15,
+  OSRMC_ERROR_DEADLINE_EXCEEDED = 16,
+  OSRMC_ERROR_OVERLOADED = 17
+} osrmc_status_t;
+
 /* Config and osrmc */
 
 typedef struct osrmc_config* osrmc_config_t;
@@ -155,17 +200,71 @@ typedef struct osrmc_match_params* osrmc_match_params_t;
 typedef struct osrmc_route_response* osrmc_route_response_t;
 typedef struct osrmc_table_response* osrmc_table_response_t;
 
+/* Incremental matrix */
+
+typedef struct osrmc_matrix* osrmc_matrix_t;
+
+/* Approximate matrix */
+
+typedef struct osrmc_approx_table* osrmc_approx_table_t;
+
+/* Isochrones */
+
+typedef struct osrmc_isochrone_params* osrmc_isochrone_params_t;
+typedef struct osrmc_isochrone_response* osrmc_isochrone_response_t;
+
+/* Warm-up and startup profiling */
+
+typedef struct osrmc_warmup_params* osrmc_warmup_params_t;
+typedef struct osrmc_startup_report* osrmc_startup_report_t;
+
+/* Local query server */
+
+typedef struct osrmc_server* osrmc_server_t;
+
 typedef struct osrmc_json* osrmc_json_t;
 /* Service-specific callbacks */
 
 typedef void (*osrmc_waypoint_handler_t)(void* data, const char* name, float longitude, float latitude);
 
+/* Streaming visitor: any callback may be NULL to skip its events */
+
+typedef struct osrmc_visitor {
+  void (*begin_object)(void* data);
+  void (*end_object)(void* data);
+  void (*begin_array)(void* data);
+  void (*end_array)(void* data);
+  void (*key)(void* data, const char* key, size_t length);
+  void (*string)(void* data, const char* value, size_t length);
+  void (*number)(void* data, double value);
+  void (*boolean)(void* data, int value);
+  void (*null)(void* data);
+
+  /* Typed shortcuts, invoked right before the generic events of the object they describe */
+  void (*route)(void* data, size_t route, double distance, double duration);
+  void (*leg)(void* data, size_t route, size_t leg, double distance, double duration);
+  void (*step)(void* data, size_t route, size_t leg, size_t step, const char* name, double distance,
+               double duration);
+  /* If set, the durations and distances matrices are reported row by row here instead of as generic events.
+   * Their key event is still followed by begin_array, then all rows, then end_array. Unreachable cells are INFINITY. */
+  void (*table_row)(void* data, const char* annotation, size_t row, const float* values, size_t count);
+} osrmc_visitor_t;
+
 
 /* Error handling */
 
 OSRMC_API const char* osrmc_error_code(osrmc_error_t error);
 OSRMC_API const char* osrmc_error_message(osrmc_error_t error);
 OSRMC_API void osrmc_error_destruct(osrmc_error_t error);
+OSRMC_API osrmc_status_t osrmc_error_status(osrmc_error_t error);
+
+// Allocation-free channel: every failure also records its status and message for the calling thread.
+// Successful calls do not reset it: the status is OSRMC_OK only until the thread's first failure or after
+// osrmc_clear_status. The message is overwritten by the thread's next failure.
+OSRMC_API osrmc_status_t osrmc_last_status(void);
+OSRMC_API const char* osrmc_last_message(void);
+OSRMC_API void osrmc_clear_status(void);
+OSRMC_API const char* osrmc_status_code(osrmc_status_t status);
 
 /* Config and osrmc */
 
@@ -175,17 +274,50 @@ OSRMC_API void osrmc_config_destruct(osrmc_config_t config);
 OSRMC_API osrmc_osrm_t osrmc_osrm_construct(osrmc_config_t config, osrmc_error_t* error);
 OSRMC_API void osrmc_osrm_destruct(osrmc_osrm_t osrm);
 
+// Connects to an osrmc_server over its Unix domain socket instead of loading a dataset.
+// This is not a drop-in transport for every caller, only for the subset below:
+// - Route takes two coordinates without steps, alternatives, annotations, bearings, radiuses or hints. Its
+//   response holds only routes[0].distance and duration, and the waypoints' location and name: no legs,
+//   geometry or hints.
+// - Table (and functions built on Table) does not support bearings, radiuses or hints.
+// - Nearest and Match fail with OSRMC_ERROR_NOT_IMPLEMENTED.
+// Handles are safe to share between threads; their requests are pipelined.
+// Requests and responses over 64 MiB (e.g. a 3000 x 3000 Table with durations and distances) fail with
+// OSRMC_ERROR_TOO_BIG; the connection stays usable.
+OSRMC_API osrmc_osrm_t osrmc_osrm_connect(const char* socket_path, osrmc_error_t* error);
+
+/* Admission control */
+
+// Queries whose estimated cost reaches expensive_cost (Table: rows x columns, Route: legs, Match: coordinates,
+// Nearest: results) share max_expensive concurrent slots per handle; cheaper queries always run immediately.
+// Expensive queries wait for a slot by priority, failing with OSRMC_ERROR_OVERLOADED if max_queue are already
+// waiting and with OSRMC_ERROR_DEADLINE_EXCEEDED if their deadline can not be met. Disabled by default (zero slots).
+// Deadlines and priorities are set per query on its parameters (osrmc_*_params_set_deadline and _set_priority).
+OSRMC_API void osrmc_osrm_set_admission(osrmc_osrm_t osrm, unsigned max_expensive, unsigned long expensive_cost,
+                                        size_t max_queue);
+OSRMC_API size_t osrmc_osrm_queue_depth(osrmc_osrm_t osrm);
+OSRMC_API size_t osrmc_osrm_running(osrmc_osrm_t osrm);
+
 /* Generic parameters */
 
 OSRMC_API void osrmc_params_add_coordinate(osrmc_params_t params, float longitude, float latitude,
                                            osrmc_error_t* error);
 OSRMC_API void osrmc_params_add_coordinate_with(osrmc_params_t params, float longitude, float latitude, float radius,
                                                 int bearing, int range, osrmc_error_t* error);
+// Appends count coordinates in one call; cheaper than count calls to osrmc_params_add_coordinate from bindings.
+OSRMC_API void osrmc_params_add_coordinates(osrmc_params_t params, const float* longitudes, const float* latitudes,
+                                            size_t count, osrmc_error_t* error);
 
 /* Route service */
 
 OSRMC_API osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_route_params_destruct(osrmc_route_params_t params);
+// Deadline in milliseconds from the moment a query with these parameters is issued and its priority, higher
+// first. Zero deadline means none. Queries fail with OSRMC_ERROR_DEADLINE_EXCEEDED once it passed, including
+// follow-up queries of the same call. Applies to osrmc_route_with and osrmc_route_visit: osrmc_route takes a
+// Python dict (see bindings/osrmcpy.py) and reads its "deadline" and "priority" keys instead.
+OSRMC_API void osrmc_route_params_set_deadline(osrmc_route_params_t params, unsigned milliseconds);
+OSRMC_API void osrmc_route_params_set_priority(osrmc_route_params_t params, int priority);
 OSRMC_API void osrmc_route_params_add_steps(osrmc_route_params_t params, int on);
 OSRMC_API void osrmc_route_params_add_alternatives(osrmc_route_params_t params, int on);
 
@@ -204,11 +336,22 @@ OSRMC_API void osrmc_table_annotations_enable_distance(osrmc_table_annotations_t
 
 OSRMC_API osrmc_table_params_t osrmc_table_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_destruct(osrmc_table_params_t params);
+OSRMC_API void osrmc_table_params_set_deadline(osrmc_table_params_t params, unsigned milliseconds);
+OSRMC_API void osrmc_table_params_set_priority(osrmc_table_params_t params, int priority);
 OSRMC_API void osrmc_table_params_set_annotations(osrmc_table_params_t params, osrmc_table_annotations_t annotations, osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_add_source(osrmc_table_params_t params, size_t index, osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_add_destination(osrmc_table_params_t params, size_t index, osrmc_error_t* error);
 
 OSRMC_API osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_error_t* error);
+
+// Same as osrmc_table but collapses coordinates within tolerance meters of each other before querying.
+// With snap set, coordinates are first snapped via the Nearest service and collapsed on their snapped locations.
+// The response is expanded back to the original coordinate indices, so the accessors below work unchanged.
+// Collapsed coordinates share the bearing, radius and hint of the first coordinate in their group.
+// If unique is not NULL, it receives the number of distinct coordinates actually queried.
+OSRMC_API osrmc_table_response_t osrmc_table_deduplicated(osrmc_osrm_t osrm, osrmc_table_params_t params,
+                                                          float tolerance, int snap, size_t* unique,
+                                                          osrmc_error_t* error);
 OSRMC_API void osrmc_table_response_destruct(osrmc_table_response_t response);
 
 // INFINITY will be returned if there is no route between the from/to.
@@ -218,18 +361,183 @@ OSRMC_API float osrmc_table_response_duration(osrmc_table_response_t response, u
 OSRMC_API float osrmc_table_response_distance(osrmc_table_response_t response, unsigned long from, unsigned long to,
                                               osrmc_error_t* error);
 
+// Copies the whole table row-major into out, which holds capacity floats. Fails with OSRMC_ERROR_INVALID_VALUE
+// without writing anything if capacity is less than rows x columns.
+// Unreachable pairs are written as INFINITY and do not raise an error.
+OSRMC_API size_t osrmc_table_response_rows(osrmc_table_response_t response, osrmc_error_t* error);
+OSRMC_API size_t osrmc_table_response_columns(osrmc_table_response_t response, osrmc_error_t* error);
+OSRMC_API void osrmc_table_response_durations(osrmc_table_response_t response, float* out, size_t capacity,
+                                              osrmc_error_t* error);
+OSRMC_API void osrmc_table_response_distances(osrmc_table_response_t response, float* out, size_t capacity,
+                                              osrmc_error_t* error);
+
+/* Incremental matrix */
+
+// A matrix owns its coordinates and keeps durations (and optionally distances) in a contiguous
+// row-major size x size buffer. Adding k coordinates only computes the k new rows and k new columns;
+// removing coordinates compacts the buffer in place. Unreachable pairs are stored as INFINITY.
+// Annotations may be NULL, in which case only durations are computed.
+// Buffers returned by osrmc_matrix_durations/distances are invalidated by the next add/remove.
+OSRMC_API osrmc_matrix_t osrmc_matrix_construct(osrmc_osrm_t osrm, osrmc_table_annotations_t annotations,
+                                                osrmc_error_t* error);
+OSRMC_API void osrmc_matrix_destruct(osrmc_matrix_t matrix);
+OSRMC_API void osrmc_matrix_add_coordinates(osrmc_matrix_t matrix, const float* longitudes, const float* latitudes,
+                                            size_t count, osrmc_error_t* error);
+OSRMC_API void osrmc_matrix_remove_coordinates(osrmc_matrix_t matrix, const size_t* indices, size_t count,
+                                               osrmc_error_t* error);
+OSRMC_API size_t osrmc_matrix_size(osrmc_matrix_t matrix);
+// NULL is returned if the matrix was not configured for the annotation.
+OSRMC_API const float* osrmc_matrix_durations(osrmc_matrix_t matrix);
+OSRMC_API const float* osrmc_matrix_distances(osrmc_matrix_t matrix);
+
+/* Approximate matrix */
+
+// Approximates durations between count coordinates in O(count + cells^2) memory.
+// Coordinates are grouped into at most cells grid cells; the coordinate closest to a cell's centroid represents it.
+// Durations between distant cells come from an exact representative matrix plus each coordinate's duration to and
+// from its representative; durations within a cell or between neighbouring cells are computed exactly on demand.
+// The error is estimated against an exact samples x samples Table over randomly chosen coordinates.
+OSRMC_API osrmc_approx_table_t osrmc_approx_table_construct(osrmc_osrm_t osrm, const float* longitudes,
+                                                            const float* latitudes, size_t count, size_t cells,
+                                                            size_t samples, osrmc_error_t* error);
+OSRMC_API void osrmc_approx_table_destruct(osrmc_approx_table_t table);
+OSRMC_API size_t osrmc_approx_table_cells(osrmc_approx_table_t table);
+// Relative error of sampled pairs in non-neighbouring cells; zero if no such pair was sampled.
+OSRMC_API float osrmc_approx_table_error_mean(osrmc_approx_table_t table);
+OSRMC_API float osrmc_approx_table_error_max(osrmc_approx_table_t table);
+// INFINITY will be returned if there is no route between the from/to.
+OSRMC_API float osrmc_approx_table_duration(osrmc_approx_table_t table, unsigned long from, unsigned long to,
+                                            osrmc_error_t* error);
+// Fills durations from a single coordinate to all coordinates into row, which must hold count floats.
+OSRMC_API void osrmc_approx_table_row(osrmc_approx_table_t table, unsigned long from, float* row,
+                                      osrmc_error_t* error);
+
+/* Isochrones */
+
+// Reachability contours around an origin for each duration threshold (seconds).
+// Durations are sampled on a lattice of cells x cells squares covering everything reachable at max_speed
+// (meters per second, default 33.3) within the largest threshold. Squares at or next to a contour are halved
+// depth times (defaults 16 and 3); samples are evaluated with one-to-many Table requests on threads threads
+// (default: hardware concurrency). Sample points snap to the nearest road.
+// Resolutions beyond 4096 points per lattice side (cells x 2^depth, depth at most 8) fail with
+// OSRMC_ERROR_INVALID_VALUE and leave the previous resolution in place.
+OSRMC_API osrmc_isochrone_params_t osrmc_isochrone_params_construct(float longitude, float latitude,
+                                                                    osrmc_error_t* error);
+OSRMC_API void osrmc_isochrone_params_destruct(osrmc_isochrone_params_t params);
+OSRMC_API void osrmc_isochrone_params_add_threshold(osrmc_isochrone_params_t params, float seconds,
+                                                    osrmc_error_t* error);
+OSRMC_API void osrmc_isochrone_params_set_resolution(osrmc_isochrone_params_t params, unsigned cells, unsigned depth,
+                                                     osrmc_error_t* error);
+OSRMC_API void osrmc_isochrone_params_set_max_speed(osrmc_isochrone_params_t params, float meters_per_second);
+OSRMC_API void osrmc_isochrone_params_set_threads(osrmc_isochrone_params_t params, unsigned threads);
+// One deadline for the whole isochrone, shared by all of its Table requests
+OSRMC_API void osrmc_isochrone_params_set_deadline(osrmc_isochrone_params_t params, unsigned milliseconds);
+OSRMC_API void osrmc_isochrone_params_set_priority(osrmc_isochrone_params_t params, int priority);
+
+OSRMC_API osrmc_isochrone_response_t osrmc_isochrone(osrmc_osrm_t osrm, osrmc_isochrone_params_t params,
+                                                     osrmc_error_t* error);
+OSRMC_API void osrmc_isochrone_response_destruct(osrmc_isochrone_response_t response);
+// Number of lattice points evaluated with Table requests.
+OSRMC_API size_t osrmc_isochrone_response_samples(osrmc_isochrone_response_t response);
+// Rings per threshold (in the order added), outer boundaries and holes alike; fill with the even-odd rule.
+// Each ring is a closed flat buffer of count longitude, latitude pairs owned by the isochrone.
+OSRMC_API size_t osrmc_isochrone_response_rings(osrmc_isochrone_response_t response, size_t threshold);
+OSRMC_API const float* osrmc_isochrone_response_ring(osrmc_isochrone_response_t response, size_t threshold,
+                                                     size_t ring, size_t* count);
+
 /* Nearest service */
 
 OSRMC_API osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_nearest_params_destruct(osrmc_nearest_params_t params);
+OSRMC_API void osrmc_nearest_params_set_deadline(osrmc_nearest_params_t params, unsigned milliseconds);
+OSRMC_API void osrmc_nearest_params_set_priority(osrmc_nearest_params_t params, int priority);
 OSRMC_API void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n, osrmc_error_t* error);
 
 /* Match service */
 
 OSRMC_API osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_match_params_destruct(osrmc_match_params_t params);
+OSRMC_API void osrmc_match_params_set_deadline(osrmc_match_params_t params, unsigned milliseconds);
+OSRMC_API void osrmc_match_params_set_priority(osrmc_match_params_t params, int priority);
 OSRMC_API void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error);
 
+/* Streaming responses */
+
+// Heap visitor with all callbacks NULL, for bindings that can not lay out osrmc_visitor_t themselves.
+OSRMC_API osrmc_visitor_t* osrmc_visitor_construct(osrmc_error_t* error);
+OSRMC_API void osrmc_visitor_destruct(osrmc_visitor_t* visitor);
+OSRMC_API void osrmc_visitor_set_route(osrmc_visitor_t* visitor,
+                                       void (*route)(void* data, size_t route, double distance, double duration));
+
+// Runs the service and streams its response through the visitor without building any intermediate tree
+// on the caller's side. Routes are reported for Route and for Match matchings.
+OSRMC_API void osrmc_route_visit(osrmc_osrm_t osrm, osrmc_route_params_t params, const osrmc_visitor_t* visitor,
+                                 void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_table_visit(osrmc_osrm_t osrm, osrmc_table_params_t params, const osrmc_visitor_t* visitor,
+                                 void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_nearest_visit(osrmc_osrm_t osrm, osrmc_nearest_params_t params, const osrmc_visitor_t* visitor,
+                                   void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_match_visit(osrmc_osrm_t osrm, osrmc_match_params_t params, const osrmc_visitor_t* visitor,
+                                 void* data, osrmc_error_t* error);
+
+OSRMC_API void osrmc_route_response_visit(osrmc_route_response_t response, const osrmc_visitor_t* visitor,
+                                          void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_table_response_visit(osrmc_table_response_t response, const osrmc_visitor_t* visitor,
+                                          void* data, osrmc_error_t* error);
+
+/* Warm-up and startup profiling */
+
+// Warm-up reports how much of each dataset file is resident in the page cache, optionally pre-faulting them first
+// (madvise plus touching every page), and then runs a synthetic mix of Route and Table queries between randomly
+// drawn coordinates added to the parameters.
+// Failing synthetic queries (e.g. no route) are ignored; they still exercise the engine.
+OSRMC_API osrmc_warmup_params_t osrmc_warmup_params_construct(osrmc_error_t* error);
+OSRMC_API void osrmc_warmup_params_destruct(osrmc_warmup_params_t params);
+OSRMC_API void osrmc_warmup_params_add_coordinate(osrmc_warmup_params_t params, float longitude, float latitude,
+                                                  osrmc_error_t* error);
+// Off by default. Handles constructed from a base path read the whole dataset into the engine's own memory, so
+// pre-faulting only adds a page cache copy of the files (roughly doubling memory use at startup). Turn it on only
+// if something else reads the files next, e.g. osrm-datastore loading them into shared memory.
+// Handles on shared memory have no dataset files and skip this step.
+OSRMC_API void osrmc_warmup_params_set_prefault(osrmc_warmup_params_t params, int on);
+OSRMC_API void osrmc_warmup_params_set_routes(osrmc_warmup_params_t params, unsigned n);
+OSRMC_API void osrmc_warmup_params_set_tables(osrmc_warmup_params_t params, unsigned n, unsigned size);
+
+OSRMC_API osrmc_startup_report_t osrmc_warmup(osrmc_osrm_t osrm, osrmc_warmup_params_t params, osrmc_error_t* error);
+OSRMC_API void osrmc_startup_report_destruct(osrmc_startup_report_t report);
+
+// Seconds spent in osrmc_osrm_construct, and from its start until the first query on the handle completed,
+// whether issued by warm-up or by the caller before it; NAN if no query has completed yet.
+OSRMC_API float osrmc_startup_report_load_seconds(osrmc_startup_report_t report);
+OSRMC_API float osrmc_startup_report_first_query_seconds(osrmc_startup_report_t report);
+// Latency percentile (0 to 100) over all synthetic queries; NAN if none ran.
+OSRMC_API float osrmc_startup_report_query_seconds(osrmc_startup_report_t report, float percentile);
+
+// Dataset files found next to the .osrm base path; none when the engine uses shared memory.
+OSRMC_API size_t osrmc_startup_report_files(osrmc_startup_report_t report);
+OSRMC_API const char* osrmc_startup_report_file_path(osrmc_startup_report_t report, size_t file);
+OSRMC_API size_t osrmc_startup_report_file_bytes(osrmc_startup_report_t report, size_t file);
+OSRMC_API size_t osrmc_startup_report_file_resident_bytes(osrmc_startup_report_t report, size_t file);
+// Seconds warm-up spent pre-faulting the file (or only inspecting it with pre-faulting off). The engine loads all
+// files inside osrmc_osrm_construct without reporting per-file timings; see osrmc_startup_report_load_seconds.
+OSRMC_API float osrmc_startup_report_file_seconds(osrmc_startup_report_t report, size_t file);
+
+/* Local query server */
+
+// Serves a handle with a local dataset to osrmc_osrm_connect clients over a Unix domain socket.
+// Concurrent two-point Route queries are coalesced into one Table request per batch, which is flushed when it
+// reaches max_batch queries (default 64) or after window_us microseconds (default 500).
+// Identical in-flight queries are computed once. Queries run on threads worker threads.
+// The socket is only accessible to its owner (mode 0600). Responses are sent by a writer thread per client;
+// clients that leave more than 256 MiB of responses unread are disconnected.
+OSRMC_API osrmc_server_t osrmc_server_construct(osrmc_osrm_t osrm, const char* socket_path, unsigned threads,
+                                                osrmc_error_t* error);
+OSRMC_API void osrmc_server_destruct(osrmc_server_t server);
+OSRMC_API void osrmc_server_set_batching(osrmc_server_t server, unsigned max_batch, unsigned window_us);
+// Blocks serving clients until osrmc_server_stop is called from another thread.
+OSRMC_API void osrmc_server_run(osrmc_server_t server, osrmc_error_t* error);
+OSRMC_API void osrmc_server_stop(osrmc_server_t server);
+
 OSRMC_API PyObject *osrmc_json_to_pyobj(osrmc_json_t obj);
 #ifdef __cplusplus
 }